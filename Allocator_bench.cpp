@@ -0,0 +1,320 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Benchmark.h"
+#include "SharedMemory.h"
+
+/*
+ * Replays allocator traces against a fresh MemoryManager and reports,
+ * per trace, the time per allocate/free, the peak fragmentation, how
+ * often the pool had to be defragmented and how many bytes that moved.
+ * Fragmentation is 1 - (largest free region / free bytes): 0 when all
+ * free space is contiguous, approaching 1 when it's scattered
+ *
+ * Without arguments three synthetic workloads are generated:
+ *
+ *  uniform   Sizes uniform in [16, 4K], random frees, ~2000 live blocks
+ *  bimodal   90% of sizes in [16, 256], 10% in [16K, 256K]
+ *  churn     Producer/consumer: variable-sized blocks freed in FIFO
+ *            order in bursts, keeping the pool 50-75% full
+ *
+ * usage: allocator_bench [--save <dir>] [trace files...]
+ *
+ * --save writes the synthetic traces to <dir> instead of replaying
+ * them. Trace files, e.g. captured in production with
+ * MemoryManager::set_trace(), are replayed instead of the synthetic
+ * workloads
+ */
+
+const size_t   default_pool = 16 << 20;
+const uint64_t default_ops  = 200000;
+
+/*
+ * Generate a trace where 'live' blocks are allocated and freed at
+ * random, with sizes drawn by 'size'
+ */
+template <typename Size>
+SharedMemory::MemoryTrace random_trace(size_t live, Size size,
+									   uint32_t seed)
+{
+	SharedMemory::MemoryTrace trace(default_pool);
+
+	std::mt19937 rng(seed);
+	std::vector<int> blocks;
+	int next_id = 0;
+
+	for (uint64_t i = 0; i < default_ops; i++)
+	{
+		if (blocks.size() < live / 2 ||
+			(blocks.size() < live && rng() % 2 == 0))
+		{
+			trace.record(SharedMemory::TraceOp::allocate, next_id,
+						 size(rng));
+			blocks.push_back(next_id++);
+		}
+		else
+		{
+			const size_t victim = rng() % blocks.size();
+			trace.record(SharedMemory::TraceOp::free, blocks[victim], 0);
+
+			blocks[victim] = blocks.back();
+			blocks.pop_back();
+		}
+	}
+
+	return trace;
+}
+
+SharedMemory::MemoryTrace uniform_trace()
+{
+	std::uniform_int_distribution<size_t> size(16, 4096);
+	return random_trace(2000,
+		[&](std::mt19937& rng) { return size(rng); }, 1);
+}
+
+SharedMemory::MemoryTrace bimodal_trace()
+{
+	std::uniform_int_distribution<size_t> small(16, 256);
+	std::uniform_int_distribution<size_t> large(16 << 10, 256 << 10);
+
+	return random_trace(500,
+		[&](std::mt19937& rng)
+		{
+			return rng() % 10 == 0 ? large(rng) : small(rng);
+		}, 2);
+}
+
+SharedMemory::MemoryTrace churn_trace()
+{
+	SharedMemory::MemoryTrace trace(default_pool);
+
+	std::mt19937 rng(3);
+	std::uniform_int_distribution<size_t> size(64, 64 << 10);
+	std::uniform_int_distribution<int>    burst(1, 64);
+
+	std::deque<std::pair<int,size_t> > queue;
+	size_t queued = 0;
+	int next_id = 0;
+
+	uint64_t ops = 0;
+	while (ops < default_ops)
+	{
+		/*
+		 * The producer writes a burst of messages, then the
+		 * consumer drains until the pool is half full
+		 */
+		for (int n = burst(rng); n > 0 && ops < default_ops; n--, ops++)
+		{
+			const size_t bytes = size(rng);
+			trace.record(SharedMemory::TraceOp::allocate, next_id,
+						 bytes);
+
+			queue.push_back(std::make_pair(next_id++, bytes));
+			queued += bytes;
+
+			if (queued > default_pool / 4 * 3)
+				break;
+		}
+
+		while (queued > default_pool / 2 && ops < default_ops)
+		{
+			trace.record(SharedMemory::TraceOp::free,
+						 queue.front().first, 0);
+
+			queued -= queue.front().second;
+			queue.pop_front();
+			ops++;
+		}
+	}
+
+	return trace;
+}
+
+struct Result
+{
+	uint64_t ops;
+	uint64_t failed;
+	double   ns_per_op;
+	double   peak_fragmentation;
+	uint64_t defrags;
+	uint64_t bytes_moved;
+	uint64_t compaction_ns;
+};
+
+/*
+ * Run the allocate and free events of a trace against 'manager'. If
+ * 'result' is given, sample fragmentation after every event
+ */
+void replay(const SharedMemory::MemoryTrace& trace,
+			SharedMemory::MemoryManager& manager, std::vector<int>& ids,
+			Result* result)
+{
+	using SharedMemory::TraceOp;
+
+	const std::vector<TraceOp>& ops = trace.ops();
+
+	for (size_t i = 0; i < ops.size(); i++)
+	{
+		const TraceOp& op = ops[i];
+
+		switch (op.op)
+		{
+		case TraceOp::allocate:
+		{
+			const int id = manager.allocate(op.arg);
+			if (op.id >= 0) ids[op.id] = id;
+			break;
+		}
+		case TraceOp::free:
+			if (op.id >= 0 && ids[op.id] >= 0)
+			{
+				manager.free(ids[op.id]);
+				ids[op.id] = -1;
+			}
+			break;
+		default:
+			continue;
+		}
+
+		if (result)
+		{
+			const double fragmentation = manager.stats().fragmentation;
+
+			if (fragmentation > result->peak_fragmentation)
+				result->peak_fragmentation = fragmentation;
+		}
+	}
+}
+
+bool run(const std::string& name, const SharedMemory::MemoryTrace& trace)
+{
+	using namespace SharedMemory;
+
+	int max_id = -1;
+	uint64_t ops = 0;
+	for (size_t i = 0; i < trace.ops().size(); i++)
+	{
+		const TraceOp& op = trace.ops()[i];
+		if (op.op == TraceOp::defrag) continue;
+
+		ops++;
+		if (op.id > max_id) max_id = op.id;
+	}
+
+	AbortIf(trace.pool() == 0 || ops == 0, false);
+
+	std::vector<char> pool(trace.pool());
+	Result result;
+	std::memset(&result, 0, sizeof(result));
+	result.ops = ops;
+
+	std::string perf_fields;
+
+	/*
+	 * First pass: timing only
+	 */
+	{
+		MemoryManager manager;
+		AbortIfNot(manager.init(pool.data(), pool.size()), false);
+
+		std::vector<int> ids(max_id+1, -1);
+
+		Bench::PerfCounters perf;
+		perf.start();
+
+		const uint64_t start = Bench::now_ns();
+		replay(trace, manager, ids, NULL);
+		result.ns_per_op = double(Bench::now_ns() - start) / ops;
+
+		perf.stop();
+		perf_fields = perf.fields(ops);
+	}
+
+	/*
+	 * Second pass: fragmentation and compaction
+	 */
+	{
+		MemoryManager manager;
+		AbortIfNot(manager.init(pool.data(), pool.size()), false);
+
+		std::vector<int> ids(max_id+1, -1);
+		replay(trace, manager, ids, &result);
+
+		const AllocatorStats stats = manager.stats();
+
+		result.failed      = stats.failed;
+		result.defrags     = stats.defrags;
+		result.bytes_moved = stats.bytes_compacted;
+		result.compaction_ns = stats.compaction_ns;
+	}
+
+	std::printf("{\"bench\":\"allocator\",\"case\":\"%s\"%s%s%s,"
+		"\"ns_per_op\":%.1f,\"peak_fragmentation\":%.4f%s%s%s%s}\n",
+		name.c_str(),
+		Bench::field("pool", trace.pool()).c_str(),
+		Bench::field("ops", result.ops).c_str(),
+		Bench::field("failed", result.failed).c_str(),
+		result.ns_per_op, result.peak_fragmentation,
+		Bench::field("defrags", result.defrags).c_str(),
+		Bench::field("bytes_moved", result.bytes_moved).c_str(),
+		Bench::field("compaction_ns", result.compaction_ns).c_str(),
+		perf_fields.c_str());
+	std::fflush(stdout);
+
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	std::string save_dir;
+	std::vector<std::string> files;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--save") == 0 && i+1 < argc)
+			save_dir = argv[++i];
+		else if (argv[i][0] == '-')
+		{
+			std::printf("usage: %s [--save <dir>] [trace files...]\n",
+						argv[0]);
+			return 1;
+		}
+		else
+			files.push_back(argv[i]);
+	}
+
+	if (!files.empty())
+	{
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			SharedMemory::MemoryTrace trace;
+			AbortIfNot(trace.load(files[i]), 1);
+			AbortIfNot(run(files[i], trace), 1);
+		}
+
+		return 0;
+	}
+
+	const char* names[] = { "uniform", "bimodal", "churn" };
+	SharedMemory::MemoryTrace traces[] =
+	{
+		uniform_trace(), bimodal_trace(), churn_trace()
+	};
+
+	for (size_t i = 0; i < 3; i++)
+	{
+		if (save_dir.empty())
+			AbortIfNot(run(names[i], traces[i]), 1);
+		else
+			AbortIfNot(traces[i].save(save_dir + "/" + names[i] +
+									  ".trace"), 1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,778 @@
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "Hooks.h"
+
+namespace SharedMemory
+{
+	/**
+	 * Helpers shared by the benchmark programs
+	 */
+	namespace Bench
+	{
+		/**
+		 * Read the monotonic clock
+		 *
+		 * @return The current time, in nanoseconds
+		 */
+		inline uint64_t now_ns()
+		{
+			struct timespec ts;
+			::clock_gettime(CLOCK_MONOTONIC, &ts);
+
+			return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull
+				+ ts.tv_nsec;
+		}
+
+		/**
+		 * Busy-wait, keeping the CPU occupied
+		 *
+		 * @param[in] ns How long to spin, in nanoseconds
+		 */
+		inline void spin_ns(uint64_t ns)
+		{
+			const uint64_t end = now_ns() + ns;
+			while (now_ns() < end);
+		}
+
+		/**
+		 * Format an extra field for \ref Histogram::report()
+		 *
+		 * @param[in] key   The field name
+		 * @param[in] value The value
+		 *
+		 * @return The field, as a JSON member with a leading comma
+		 */
+		inline std::string field(const std::string& key, uint64_t value)
+		{
+			char buf[32];
+			std::snprintf(buf, sizeof(buf), "%llu",
+						  static_cast<unsigned long long>(value));
+
+			return ",\"" + key + "\":" + buf;
+		}
+
+		/**
+		 ******************************************************************
+		 *
+		 * @class Histogram
+		 *
+		 * A high dynamic range histogram of latencies, in the style of
+		 * HdrHistogram. Values are kept to a fixed number of significant
+		 * digits across the whole range, so memory use is bounded no
+		 * matter how many samples are recorded and recording is just an
+		 * index computation and an increment
+		 *
+		 * Each bucket covers twice the range of the one before it, and
+		 * is split into the same number of linear sub-buckets. The
+		 * lower half of every bucket but the first would duplicate the
+		 * previous bucket, so only the upper halves are stored
+		 *
+		 ******************************************************************
+		 */
+		class Histogram
+		{
+
+		public:
+
+			/**
+			 * Constructor
+			 *
+			 * @param[in] highest The largest value to track; anything
+			 *                    above is clamped to it
+			 * @param[in] digits  Significant decimal digits to keep,
+			 *                    from 1 to 5
+			 */
+			explicit Histogram(uint64_t highest = 3600000000000ull,
+							   int digits = 3)
+				: _counts(), _highest(highest), _max(0), _min(UINT64_MAX),
+				  _sub_half_bits(0), _total(0)
+			{
+				uint64_t largest = 2;
+				for (int i = 0; i < digits; i++)
+					largest *= 10;
+
+				int bits = 0;
+				while ((uint64_t(1) << bits) < largest)
+					bits++;
+
+				_sub_half_bits = bits - 1;
+
+				/*
+				 * Add buckets until the top one reaches 'highest'
+				 */
+				int buckets = 1;
+				for (uint64_t limit = uint64_t(1) << bits;
+					 limit <= highest && buckets < 64 - bits;
+					 limit <<= 1)
+					buckets++;
+
+				_counts.assign((buckets+1) << _sub_half_bits, 0);
+			}
+
+			/**
+			 * Record one value
+			 *
+			 * @param[in] value The value, e.g. in nanoseconds
+			 */
+			void add(uint64_t value)
+			{
+				if (value > _highest) value = _highest;
+
+				_counts[_index(value)]++;
+				_total++;
+
+				if (value > _max) _max = value;
+				if (value < _min) _min = value;
+			}
+
+			/**
+			 * Forget all recorded values
+			 */
+			void reset()
+			{
+				std::fill(_counts.begin(), _counts.end(), 0);
+				_max   = 0;
+				_min   = UINT64_MAX;
+				_total = 0;
+			}
+
+			/**
+			 * Get the number of values recorded
+			 *
+			 * @return The count
+			 */
+			uint64_t count() const
+			{
+				return _total;
+			}
+
+			/**
+			 * Get the largest value recorded (exactly)
+			 *
+			 * @return The maximum, or 0 if empty
+			 */
+			uint64_t max() const
+			{
+				return _max;
+			}
+
+			/**
+			 * Get the smallest value recorded (exactly)
+			 *
+			 * @return The minimum, or 0 if empty
+			 */
+			uint64_t min() const
+			{
+				return _total == 0 ? 0 : _min;
+			}
+
+			/**
+			 * Get the value at a percentile, to within the precision
+			 * of the histogram
+			 *
+			 * @param[in] pct The percentile, between 0 and 100
+			 *
+			 * @return The highest value equivalent to the one at that
+			 *         percentile
+			 */
+			uint64_t percentile(double pct) const
+			{
+				if (_total == 0)
+					return 0;
+
+				if (pct >= 100.0)
+					return _max;
+
+				uint64_t target = static_cast<uint64_t>(
+					pct / 100.0 * _total + 0.5);
+				if (target < 1) target = 1;
+
+				uint64_t seen = 0;
+				for (size_t i = 0; i < _counts.size(); i++)
+				{
+					seen += _counts[i];
+					if (seen >= target)
+						return std::min(_highest_equivalent(i), _max);
+				}
+
+				return _max;
+			}
+
+			/**
+			 * Print a summary to stdout, as one JSON object per line
+			 *
+			 * @param[in] bench The benchmark name
+			 * @param[in] name  The name of the measured case
+			 * @param[in] extra Extra members, see \ref field()
+			 */
+			void report(const std::string& bench,
+						const std::string& name,
+						const std::string& extra = "") const
+			{
+				std::printf("{\"bench\":\"%s\",\"case\":\"%s\"%s,"
+					"\"count\":%llu,\"min_ns\":%llu,\"p50_ns\":%llu,"
+					"\"p99_ns\":%llu,\"p99.9_ns\":%llu,"
+					"\"max_ns\":%llu}\n",
+					bench.c_str(), name.c_str(), extra.c_str(),
+					(unsigned long long)count(),
+					(unsigned long long)min(),
+					(unsigned long long)percentile(50.0),
+					(unsigned long long)percentile(99.0),
+					(unsigned long long)percentile(99.9),
+					(unsigned long long)max());
+				std::fflush(stdout);
+			}
+
+		private:
+
+			size_t _index(uint64_t value) const
+			{
+				const uint64_t mask =
+					(uint64_t(1) << (_sub_half_bits+1)) - 1;
+
+				const int bucket = 63 - __builtin_clzll(value | mask)
+					- _sub_half_bits;
+				const uint64_t sub = value >> bucket;
+
+				return (static_cast<size_t>(bucket) << _sub_half_bits)
+					+ static_cast<size_t>(sub);
+			}
+
+			uint64_t _highest_equivalent(size_t index) const
+			{
+				const uint64_t half = uint64_t(1) << _sub_half_bits;
+
+				int bucket = static_cast<int>(index >> _sub_half_bits) - 1;
+				uint64_t sub = (index & (half-1)) + half;
+
+				if (bucket < 0)
+				{
+					bucket = 0;
+					sub   -= half;
+				}
+
+				return ((sub+1) << bucket) - 1;
+			}
+
+			std::vector<uint64_t>
+					 _counts;
+			uint64_t _highest;
+			uint64_t _max;
+			uint64_t _min;
+			int      _sub_half_bits;
+			uint64_t _total;
+		};
+
+		/**
+		 ******************************************************************
+		 *
+		 * @class PerfCounters
+		 *
+		 * Hardware counters read around a measured loop through
+		 * perf_event_open(2), to tell whether a change is missing cache
+		 * or TLB rather than just getting slower:
+		 *
+		 *  PerfCounters perf;
+		 *  perf.start();
+		 *  ... ops operations ...
+		 *  perf.stop();
+		 *  hist.report("bench", "case", perf.fields(ops));
+		 *
+		 * Each counter is opened on its own, so any the CPU or kernel
+		 * doesn't offer (e.g. in a VM, or with perf_event_paranoid set
+		 * high) are simply left out of the report. If the kernel won't
+		 * count kernel time, user time alone is counted. Setting
+		 * SHARED_MEMORY_NO_PERF in the environment turns all of them
+		 * off
+		 *
+		 * Counts include whatever timing is done inside the loop, and
+		 * are scaled up if the kernel had to multiplex the counters
+		 *
+		 ******************************************************************
+		 */
+		class PerfCounters
+		{
+
+		public:
+
+			/**
+			 *  The counters read
+			 */
+			typedef enum
+			{
+				cycles       = 0,
+				instructions = 1,
+				llc_misses   = 2,
+				dtlb_misses  = 3,
+				num_counters = 4
+
+			} counter_t;
+
+			/**
+			 * Constructor
+			 *
+			 * @param[in] children Also count processes forked after
+			 *                     this, once they have exited
+			 */
+			explicit PerfCounters(bool children = false)
+			{
+				for (int i = 0; i < num_counters; i++)
+				{
+					_fds[i]    = -1;
+					_values[i] = 0;
+				}
+
+				if (std::getenv("SHARED_MEMORY_NO_PERF"))
+					return;
+
+				for (int i = 0; i < num_counters; i++)
+					_fds[i] = _open(static_cast<counter_t>(i), children);
+			}
+
+			/**
+			 * Destructor
+			 */
+			~PerfCounters()
+			{
+				for (int i = 0; i < num_counters; i++)
+				{
+					if (_fds[i] != -1) ::close(_fds[i]);
+				}
+			}
+
+			PerfCounters(const PerfCounters&) = delete;
+			PerfCounters& operator=(const PerfCounters&) = delete;
+
+			/**
+			 * Check whether a counter could be opened
+			 *
+			 * @param[in] counter The counter
+			 *
+			 * @return True if it is being read
+			 */
+			bool available(counter_t counter) const
+			{
+				return _fds[counter % num_counters] != -1;
+			}
+
+			/**
+			 * Zero and start all counters
+			 */
+			void start()
+			{
+#ifdef __linux__
+				for (int i = 0; i < num_counters; i++)
+				{
+					if (_fds[i] == -1) continue;
+
+					::ioctl(_fds[i], PERF_EVENT_IOC_RESET, 0);
+					::ioctl(_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+				}
+#endif
+			}
+
+			/**
+			 * Stop all counters and take their values
+			 */
+			void stop()
+			{
+#ifdef __linux__
+				for (int i = 0; i < num_counters; i++)
+				{
+					if (_fds[i] == -1) continue;
+
+					::ioctl(_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+					/*
+					 * value, time enabled, time running
+					 */
+					uint64_t data[3];
+					if (::read(_fds[i], data, sizeof(data))
+						!= sizeof(data))
+					{
+						_values[i] = 0;
+						continue;
+					}
+
+					_values[i] = data[2] == 0 ? 0 :
+						static_cast<uint64_t>(
+							double(data[0]) * data[1] / data[2]);
+				}
+#endif
+			}
+
+			/**
+			 * Get a count taken by \ref stop()
+			 *
+			 * @param[in] counter The counter
+			 *
+			 * @return The count, or 0 if not available
+			 */
+			uint64_t value(counter_t counter) const
+			{
+				return _values[counter % num_counters];
+			}
+
+			/**
+			 * Format the available counts, divided by the number of
+			 * operations, as extra fields for \ref Histogram::report()
+			 *
+			 * @param[in] ops The number of operations measured
+			 *
+			 * @return The fields, e.g. ",\"cycles_per_op\":123.4", or
+			 *         an empty string if none are available
+			 */
+			std::string fields(uint64_t ops) const
+			{
+				static const char* names[num_counters] =
+					{ "cycles", "instructions", "llc_misses",
+					  "dtlb_misses" };
+
+				std::string out;
+				if (ops == 0) return out;
+
+				for (int i = 0; i < num_counters; i++)
+				{
+					if (_fds[i] == -1) continue;
+
+					char buf[64];
+					std::snprintf(buf, sizeof(buf), ",\"%s_per_op\":%.3f",
+								  names[i], double(_values[i]) / ops);
+					out += buf;
+				}
+
+				return out;
+			}
+
+		private:
+
+			static int _open(counter_t counter, bool children)
+			{
+#ifdef __linux__
+				struct perf_event_attr attr;
+				std::memset(&attr, 0, sizeof(attr));
+
+				attr.size     = sizeof(attr);
+				attr.disabled = 1;
+				attr.inherit  = children ? 1 : 0;
+				attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+					| PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+				switch (counter)
+				{
+				case cycles:
+					attr.type   = PERF_TYPE_HARDWARE;
+					attr.config = PERF_COUNT_HW_CPU_CYCLES;
+					break;
+				case instructions:
+					attr.type   = PERF_TYPE_HARDWARE;
+					attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+					break;
+				case llc_misses:
+					attr.type   = PERF_TYPE_HW_CACHE;
+					attr.config = PERF_COUNT_HW_CACHE_LL
+						| PERF_COUNT_HW_CACHE_OP_READ << 8
+						| PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+					break;
+				case dtlb_misses:
+					attr.type   = PERF_TYPE_HW_CACHE;
+					attr.config = PERF_COUNT_HW_CACHE_DTLB
+						| PERF_COUNT_HW_CACHE_OP_READ << 8
+						| PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+					break;
+				default:
+					return -1;
+				}
+
+				int fd = ::syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+								   0);
+				if (fd == -1)
+				{
+					/*
+					 * Unprivileged users may only count user time
+					 */
+					attr.exclude_kernel = 1;
+					attr.exclude_hv     = 1;
+
+					fd = ::syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+								   0);
+				}
+
+				return fd;
+#else
+				(void)counter; (void)children;
+				return -1;
+#endif
+			}
+
+			int      _fds[num_counters];
+			uint64_t _values[num_counters];
+		};
+
+		/**
+		 ******************************************************************
+		 *
+		 * @class HistogramHooks
+		 *
+		 * Hooks (see Hooks.h) that time every instrumented operation
+		 * into a histogram per operation. The histograms are kept per
+		 * thread, so \ref report() covers the calling thread only
+		 *
+		 ******************************************************************
+		 */
+		struct HistogramHooks
+		{
+			static uint64_t begin(probe_t, uint64_t)
+			{
+				return now_ns();
+			}
+
+			static void end(probe_t probe, uint64_t start, uint64_t)
+			{
+				histogram(probe).add(now_ns() - start);
+			}
+
+			/**
+			 * Get the histogram of an operation
+			 *
+			 * @param[in] probe The operation
+			 *
+			 * @return Its histogram, for the calling thread
+			 */
+			static Histogram& histogram(probe_t probe)
+			{
+				static thread_local Histogram histograms[probe_count];
+				return histograms[probe % probe_count];
+			}
+
+			/**
+			 * Print the histogram of each operation that ran, see
+			 * \ref Histogram::report()
+			 *
+			 * @param[in] bench The benchmark name
+			 */
+			static void report(const std::string& bench)
+			{
+				static const char* names[probe_count] =
+					{ "allocate", "defrag", "read", "write" };
+
+				for (int i = 0; i < probe_count; i++)
+				{
+					const Histogram& hist =
+						histogram(static_cast<probe_t>(i));
+
+					if (hist.count() > 0)
+						hist.report(bench, names[i]);
+				}
+			}
+		};
+
+		/**
+		 * Raise the open file limit as far as it goes, since each
+		 * attached segment holds a descriptor open in each process,
+		 * and work out how many segments that leaves room for
+		 *
+		 * @param[in] segments The number of segments wanted
+		 * @param[in] spare    Descriptors to leave for everything
+		 *                     else
+		 *
+		 * @return \a segments, or fewer if the limit is too low
+		 */
+		inline size_t fit_open_files(size_t segments, size_t spare = 64)
+		{
+			struct rlimit limit;
+			if (::getrlimit(RLIMIT_NOFILE, &limit) != 0)
+				return segments;
+
+			limit.rlim_cur = limit.rlim_max;
+			if (::setrlimit(RLIMIT_NOFILE, &limit) != 0 &&
+					::getrlimit(RLIMIT_NOFILE, &limit) != 0)
+				return segments;
+
+			if (limit.rlim_cur == RLIM_INFINITY ||
+					segments + spare <= limit.rlim_cur)
+				return segments;
+
+			return limit.rlim_cur > spare ? limit.rlim_cur - spare : 0;
+		}
+
+		/**
+		 ******************************************************************
+		 *
+		 * @class SegmentServer
+		 *
+		 * Creates numbered segments in a child process, as they would be
+		 * in practice, and holds them until \ref stop(). \a Memory is
+		 * RemoteMemory: it's a parameter so that this header needn't
+		 * include SharedMemory.h, which must come after it for the
+		 * hooks to take effect
+		 *
+		 ******************************************************************
+		 */
+		template <typename Memory>
+		class SegmentServer
+		{
+
+		public:
+
+			/**
+			 * Constructor
+			 *
+			 * @param[in] prefix The segments' names are this and
+			 *                   their number
+			 */
+			explicit SegmentServer(const std::string& prefix)
+				: _child(-1), _go(-1), _prefix(prefix)
+			{
+			}
+
+			/**
+			 * Destructor
+			 */
+			~SegmentServer()
+			{
+				stop();
+			}
+
+			SegmentServer(const SegmentServer&) = delete;
+			SegmentServer& operator=(const SegmentServer&) = delete;
+
+			/**
+			 * Get the name of a segment
+			 *
+			 * @param[in] index Its number, from 0
+			 *
+			 * @return The name, with its leading '/'
+			 */
+			std::string name(size_t index) const
+			{
+				return "/" + _prefix + "_" + std::to_string(index);
+			}
+
+			/**
+			 * Fork the child and wait until it has created the
+			 * segments
+			 *
+			 * @param[in] segments How many to create
+			 * @param[in] access   Permissions to give other processes
+			 * @param[in] size     The size of each
+			 *
+			 * @return True on success
+			 */
+			template <typename Access>
+			bool start(size_t segments, Access access, size_t size)
+			{
+				if (_child != -1)
+					return false;
+
+				int ready[2], go[2];
+				if (::pipe(ready) == -1)
+					return false;
+
+				if (::pipe(go) == -1)
+				{
+					::close(ready[0]);
+					::close(ready[1]);
+					return false;
+				}
+
+				_child = ::fork();
+				if (_child == 0)
+				{
+					::close(ready[0]);
+					::close(go[1]);
+					::_exit(_serve(segments, access, size, ready[1],
+								   go[0]));
+				}
+
+				::close(ready[1]);
+				::close(go[0]);
+				_go = go[1];
+
+				char c;
+				const bool ok =
+					_child != -1 && ::read(ready[0], &c, 1) == 1;
+
+				::close(ready[0]);
+				return ok;
+			}
+
+			/**
+			 * Let the child destroy the segments and exit
+			 *
+			 * @return True if it ran without error, or was never
+			 *         started
+			 */
+			bool stop()
+			{
+				if (_go != -1)
+					::close(_go);
+				_go = -1;
+
+				if (_child == -1)
+					return true;
+
+				int status;
+				const bool ok = ::waitpid(_child, &status, 0) == _child &&
+					WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+				_child = -1;
+				return ok;
+			}
+
+		private:
+
+			/*
+			 * The child: create the segments, then hold them until
+			 * the parent closes 'go_fd'
+			 */
+			template <typename Access>
+			int _serve(size_t segments, Access access, size_t size,
+					   int ready_fd, int go_fd) const
+			{
+				std::vector<Memory> mems(segments);
+
+				bool ok = true;
+				for (size_t i = 0; i < segments && ok; i++)
+				{
+					::shm_unlink(name(i).c_str());
+					ok = mems[i].create(name(i), access, size);
+				}
+
+				if (ok) ok = ::write(ready_fd, "x", 1) == 1;
+				::close(ready_fd);
+
+				char c;
+				if (ok) ok = ::read(go_fd, &c, 1) == 0;
+
+				return ok ? 0 : 1;
+			}
+
+			pid_t       _child;
+			int         _go;
+			std::string _prefix;
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,1287 @@
+#ifndef __CONTAINERS_H__
+#define __CONTAINERS_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#include "abort.h"
+#include "OffsetPtr.h"
+#include "SharedMemory.h"
+
+/*
+ * Containers that live in a segment and that every process mapping it
+ * can read in place. Each keeps its storage in a MemoryManager pool
+ * over the segment's data, and refers to it by \ref OffsetPtr, so
+ * there is nothing to copy or fix up when a client maps the segment
+ * at another address. The containers hold nothing local to the
+ * process that built them: operations that allocate take the pool
+ * as an argument, and only the process that owns the pool may call
+ * them. E.g. the writer:
+ *
+ *  struct Book
+ *  {
+ *      SharedVector<Order> orders;
+ *      StringHeap          symbols;
+ *  };
+ *
+ *  Book* book = new (mem.data()) Book();
+ *
+ *  MemoryManager pool;
+ *  pool.init(static_cast<char*>(mem.data()) + sizeof(Book),
+ *            size - sizeof(Book));
+ *
+ *  book->orders.push_back(pool, order);
+ *
+ * and a reader:
+ *
+ *  const Book* book = static_cast<const Book*>(client.data(id));
+ *
+ *  for (const Order& order : book->orders) ...
+ *
+ * Like the rest of a segment's data, a container must not be read
+ * while it's being changed: the writer holds RemoteMemory::lock()
+ * while it modifies, and readers MemoryClient::lock_shared() while
+ * they read. Elements are copied as bytes, so they must be trivially
+ * copyable, and must not be pointers
+ *
+ * A read-only client can't take the segment lock. Instead, each
+ * container has a \ref ContainerVersion that the writer bumps around
+ * every change it makes, and the container's copy() methods copy out
+ * under it, retrying until they see no change:
+ *
+ *  Order  orders[100];
+ *  size_t count;
+ *
+ *  if (book->orders.copy(orders, 100, count)) ...
+ *
+ * The writer must still mark changes it makes through references,
+ * e.g. from a non-const operator[]:
+ *
+ *  {
+ *      ContainerVersion::Writer change(book->orders.version());
+ *      book->orders[0].price = 42;
+ *  }
+ */
+
+namespace SharedMemory
+{
+	/**
+	 ******************************************************************
+	 *
+	 * @class ContainerVersion
+	 *
+	 * The sequence number of a container, odd while it's being
+	 * changed, so that readers that don't hold the segment lock can
+	 * tell whether what they copied is consistent. Only one process
+	 * may change the container at a time
+	 *
+	 ******************************************************************
+	 */
+	class ContainerVersion
+	{
+
+	public:
+
+		/**
+		 * Marks a change to the container for as long as it's in
+		 * scope
+		 */
+		class Writer
+		{
+
+		public:
+
+			explicit Writer(ContainerVersion& version)
+				: _version(version)
+			{
+				/*
+				 * A writer that died mid-change leaves the sequence
+				 * odd, so round up rather than add to it
+				 */
+				_seq = _version._seq.load(std::memory_order_relaxed) | 1;
+
+				_version._seq.store(_seq, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_release);
+			}
+
+			~Writer()
+			{
+				_version._seq.store(_seq + 1, std::memory_order_release);
+			}
+
+			Writer(const Writer&) = delete;
+			Writer& operator=(const Writer&) = delete;
+
+		private:
+
+			ContainerVersion& _version;
+			uint64_t _seq;
+		};
+
+		/**
+		 * How many times \ref read() tries before giving up
+		 */
+		static const int max_tries = 10000;
+
+		/**
+		 * Constructor
+		 */
+		ContainerVersion() : _seq(0)
+		{
+		}
+
+		ContainerVersion(const ContainerVersion&) = delete;
+		ContainerVersion& operator=(const ContainerVersion&) = delete;
+
+		/**
+		 * Run \a copy until it runs start to finish without the
+		 * container changing. \a copy must check what it reads
+		 * before following it, since a change can leave it
+		 * inconsistent, and return false if it doesn't add up
+		 *
+		 * @param[in] copy Copies what the caller wants out of the
+		 *                 container
+		 *
+		 * @return True on success, false if a change never finished
+		 *         (e.g. because the writer died during it)
+		 */
+		template <typename Copy>
+		bool read(Copy copy) const
+		{
+			for (int i = 0; i < max_tries; i++)
+			{
+				const uint64_t seq =
+					_seq.load(std::memory_order_acquire);
+
+				if (seq & 1)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+
+				const bool ok = copy();
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+
+				if (ok && _seq.load(std::memory_order_relaxed) == seq)
+					return true;
+			}
+
+			return false;
+		}
+
+	private:
+
+		std::atomic<uint64_t> _seq;
+	};
+
+	/*
+	 * Move a container's elements to new storage from the pool. The
+	 * old storage is returned to the pool
+	 */
+	template <typename T>
+	bool _regrow(MemoryManager& pool, OffsetPtr<T>& data, size_t count,
+				 size_t capacity)
+	{
+		AbortIf(capacity > SIZE_MAX / sizeof(T), false);
+
+		void* addr = pool.allocate_ptr(capacity * sizeof(T), alignof(T));
+		AbortIfNot(addr, false);
+
+		if (count > 0)
+			std::memcpy(addr, data.get(), count * sizeof(T));
+
+		if (data)
+			pool.free_ptr(data.get());
+
+		data = static_cast<T*>(addr);
+		return true;
+	}
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class SharedVector
+	 *
+	 * A growable array in a segment. Readers iterate it as a plain
+	 * array of T. Growing moves the elements, so pointers into it are
+	 * only good until the next change
+	 *
+	 ******************************************************************
+	 */
+	template <typename T>
+	class SharedVector
+	{
+		static_assert(std::is_trivially_copyable<T>::value &&
+			!std::is_pointer<T>::value,
+			"Elements must be trivially copyable and not pointers");
+
+	public:
+
+		typedef T        value_type;
+		typedef T*       iterator;
+		typedef const T* const_iterator;
+
+		/**
+		 * Constructor
+		 */
+		SharedVector() : _capacity(0), _data(), _size(0), _version()
+		{
+		}
+
+		SharedVector(const SharedVector&) = delete;
+		SharedVector& operator=(const SharedVector&) = delete;
+
+		const T* begin() const { return _data.get(); }
+		const T* end()   const { return _data.get() + _size; }
+
+		T* begin() { return _data.get(); }
+		T* end()   { return _data.get() + _size; }
+
+		const T& operator[](size_t index) const
+		{
+			return _data.get()[index];
+		}
+
+		T& operator[](size_t index)
+		{
+			return _data.get()[index];
+		}
+
+		/**
+		 * Get the number of elements
+		 *
+		 * @return The count
+		 */
+		size_t size() const
+		{
+			return _size;
+		}
+
+		/**
+		 * Get the number of elements there is room for
+		 *
+		 * @return The count
+		 */
+		size_t capacity() const
+		{
+			return _capacity;
+		}
+
+		bool empty() const
+		{
+			return _size == 0;
+		}
+
+		/**
+		 * Get the version that marks changes, for readers that don't
+		 * hold the segment lock
+		 */
+		const ContainerVersion& version() const
+		{
+			return _version;
+		}
+
+		ContainerVersion& version()
+		{
+			return _version;
+		}
+
+		/**
+		 * Copy the elements out without holding the segment lock, as
+		 * a read-only client must
+		 *
+		 * @param[out] out   Where to copy to
+		 * @param[in]  max   Room in \a out, in elements
+		 * @param[out] count The number of elements copied, which is
+		 *                   less than \ref size() if \a max is
+		 *
+		 * @return True on success
+		 */
+		bool copy(T* out, size_t max, size_t& count) const
+		{
+			return _version.read([&]() {
+				const size_t size = _size;
+				const T* data     = _data.get();
+
+				if (size > _capacity || (size > 0 && data == NULL))
+					return false;
+
+				count = std::min(size, max);
+				std::memcpy(out, data, count * sizeof(T));
+				return true;
+			});
+		}
+
+		/**
+		 * Make room for at least \a count elements
+		 *
+		 * @param[in] pool  The pool the vector allocates from
+		 * @param[in] count The number of elements
+		 *
+		 * @return True on success
+		 */
+		bool reserve(MemoryManager& pool, size_t count)
+		{
+			ContainerVersion::Writer change(_version);
+			return _reserve(pool, count);
+		}
+
+		/**
+		 * Append an element, doubling the storage if it's full
+		 *
+		 * @param[in] pool  The pool the vector allocates from
+		 * @param[in] value The element
+		 *
+		 * @return True on success
+		 */
+		bool push_back(MemoryManager& pool, const T& value)
+		{
+			ContainerVersion::Writer change(_version);
+
+			if (_size == _capacity)
+			{
+				AbortIfNot(_reserve(pool, _capacity ? 2*_capacity : 8),
+					false);
+			}
+
+			_data.get()[_size++] = value;
+			return true;
+		}
+
+		/**
+		 * Remove the last element
+		 *
+		 * @return True on success, false if empty
+		 */
+		bool pop_back()
+		{
+			AbortIf(_size == 0, false);
+
+			ContainerVersion::Writer change(_version);
+
+			_size--;
+			return true;
+		}
+
+		/**
+		 * Change the number of elements
+		 *
+		 * @param[in] pool  The pool the vector allocates from
+		 * @param[in] count The new number of elements
+		 * @param[in] value The value of any elements added
+		 *
+		 * @return True on success
+		 */
+		bool resize(MemoryManager& pool, size_t count,
+					const T& value = T())
+		{
+			ContainerVersion::Writer change(_version);
+
+			AbortIfNot(_reserve(pool, count),
+				false);
+
+			for (size_t i = _size; i < count; i++)
+				_data.get()[i] = value;
+
+			_size = count;
+			return true;
+		}
+
+		/**
+		 * Remove all elements, keeping the storage
+		 */
+		void clear()
+		{
+			ContainerVersion::Writer change(_version);
+			_size = 0;
+		}
+
+		/**
+		 * Remove all elements and return the storage to the pool.
+		 * Do this before the vector itself goes away
+		 *
+		 * @param[in] pool The pool the vector allocates from
+		 */
+		void release(MemoryManager& pool)
+		{
+			ContainerVersion::Writer change(_version);
+
+			if (_data)
+				pool.free_ptr(_data.get());
+
+			_capacity = 0;
+			_data     = NULL;
+			_size     = 0;
+		}
+
+	private:
+
+		bool _reserve(MemoryManager& pool, size_t count)
+		{
+			if (count <= _capacity)
+				return true;
+
+			AbortIfNot(_regrow(pool, _data, _size, count),
+				false);
+
+			_capacity = count;
+			return true;
+		}
+
+		size_t           _capacity;
+		OffsetPtr<T>     _data;
+		size_t           _size;
+		ContainerVersion _version;
+	};
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class SharedDeque
+	 *
+	 * A double-ended queue in a segment, kept as a ring buffer that
+	 * doubles when full. Pushing and popping at either end are
+	 * constant time, and readers iterate from front to back without
+	 * copying, the iterator wrapping around the end of the ring
+	 *
+	 ******************************************************************
+	 */
+	template <typename T>
+	class SharedDeque
+	{
+		static_assert(std::is_trivially_copyable<T>::value &&
+			!std::is_pointer<T>::value,
+			"Elements must be trivially copyable and not pointers");
+
+		/*
+		 * An iterator over V, which is T or const T
+		 */
+		template <typename V, typename Deque>
+		class _Iterator
+		{
+
+		public:
+
+			typedef V                               value_type;
+			typedef std::ptrdiff_t                  difference_type;
+			typedef V*                              pointer;
+			typedef V&                              reference;
+			typedef std::bidirectional_iterator_tag iterator_category;
+
+			_Iterator(Deque* deque, size_t index)
+				: _deque(deque), _index(index)
+			{
+			}
+
+			V& operator*() const
+			{
+				return (*_deque)[_index];
+			}
+
+			V* operator->() const
+			{
+				return &(*_deque)[_index];
+			}
+
+			_Iterator& operator++()
+			{
+				_index++;
+				return *this;
+			}
+
+			_Iterator& operator--()
+			{
+				_index--;
+				return *this;
+			}
+
+			_Iterator operator++(int)
+			{
+				return _Iterator(_deque, _index++);
+			}
+
+			_Iterator operator--(int)
+			{
+				return _Iterator(_deque, _index--);
+			}
+
+			bool operator==(const _Iterator& other) const
+			{
+				return _index == other._index;
+			}
+
+			bool operator!=(const _Iterator& other) const
+			{
+				return _index != other._index;
+			}
+
+		private:
+
+			Deque* _deque;
+			size_t _index;
+		};
+
+	public:
+
+		typedef T value_type;
+		typedef _Iterator<T, SharedDeque> iterator;
+		typedef _Iterator<const T, const SharedDeque>
+			const_iterator;
+
+		/**
+		 * Constructor
+		 */
+		SharedDeque()
+			: _capacity(0), _data(), _head(0), _size(0), _version()
+		{
+		}
+
+		SharedDeque(const SharedDeque&) = delete;
+		SharedDeque& operator=(const SharedDeque&) = delete;
+
+		const_iterator begin() const
+		{
+			return const_iterator(this, 0);
+		}
+
+		const_iterator end() const
+		{
+			return const_iterator(this, _size);
+		}
+
+		iterator begin() { return iterator(this, 0); }
+		iterator end()   { return iterator(this, _size); }
+
+		/**
+		 * Access an element by its position from the front
+		 */
+		const T& operator[](size_t index) const
+		{
+			return _data.get()[_slot(index)];
+		}
+
+		T& operator[](size_t index)
+		{
+			return _data.get()[_slot(index)];
+		}
+
+		const T& front() const { return (*this)[0]; }
+		const T& back()  const { return (*this)[_size-1]; }
+
+		T& front() { return (*this)[0]; }
+		T& back()  { return (*this)[_size-1]; }
+
+		/**
+		 * Get the number of elements
+		 *
+		 * @return The count
+		 */
+		size_t size() const
+		{
+			return _size;
+		}
+
+		/**
+		 * Get the number of elements there is room for
+		 *
+		 * @return The count
+		 */
+		size_t capacity() const
+		{
+			return _capacity;
+		}
+
+		bool empty() const
+		{
+			return _size == 0;
+		}
+
+		/**
+		 * Get the version that marks changes, for readers that don't
+		 * hold the segment lock
+		 */
+		const ContainerVersion& version() const
+		{
+			return _version;
+		}
+
+		ContainerVersion& version()
+		{
+			return _version;
+		}
+
+		/**
+		 * Copy the elements out from front to back without holding
+		 * the segment lock, as a read-only client must
+		 *
+		 * @param[out] out   Where to copy to
+		 * @param[in]  max   Room in \a out, in elements
+		 * @param[out] count The number of elements copied, which is
+		 *                   less than \ref size() if \a max is
+		 *
+		 * @return True on success
+		 */
+		bool copy(T* out, size_t max, size_t& count) const
+		{
+			return _version.read([&]() {
+				const size_t capacity = _capacity;
+				const size_t head     = _head;
+				const size_t size     = _size;
+				const T* data         = _data.get();
+
+				if (size > capacity || (capacity > 0 &&
+						(head >= capacity || data == NULL)))
+					return false;
+
+				count = std::min(size, max);
+
+				const size_t first = std::min(count, capacity - head);
+
+				if (first > 0)
+					std::memcpy(out, data + head, first * sizeof(T));
+				if (count > first)
+					std::memcpy(out + first, data,
+								(count - first) * sizeof(T));
+				return true;
+			});
+		}
+
+		/**
+		 * Make room for at least \a count elements. The elements are
+		 * moved to the start of the new ring
+		 *
+		 * @param[in] pool  The pool the deque allocates from
+		 * @param[in] count The number of elements
+		 *
+		 * @return True on success
+		 */
+		bool reserve(MemoryManager& pool, size_t count)
+		{
+			ContainerVersion::Writer change(_version);
+			return _reserve(pool, count);
+		}
+
+		/**
+		 * Append an element at the back
+		 *
+		 * @param[in] pool  The pool the deque allocates from
+		 * @param[in] value The element
+		 *
+		 * @return True on success
+		 */
+		bool push_back(MemoryManager& pool, const T& value)
+		{
+			ContainerVersion::Writer change(_version);
+
+			AbortIfNot(_make_room(pool),
+				false);
+
+			_data.get()[_slot(_size)] = value;
+			_size++;
+
+			return true;
+		}
+
+		/**
+		 * Prepend an element at the front
+		 *
+		 * @param[in] pool  The pool the deque allocates from
+		 * @param[in] value The element
+		 *
+		 * @return True on success
+		 */
+		bool push_front(MemoryManager& pool, const T& value)
+		{
+			ContainerVersion::Writer change(_version);
+
+			AbortIfNot(_make_room(pool),
+				false);
+
+			_head = _head == 0 ? _capacity - 1 : _head - 1;
+			_data.get()[_head] = value;
+			_size++;
+
+			return true;
+		}
+
+		/**
+		 * Remove the first element
+		 *
+		 * @return True on success, false if empty
+		 */
+		bool pop_front()
+		{
+			AbortIf(_size == 0, false);
+
+			ContainerVersion::Writer change(_version);
+
+			_head = _slot(1);
+			_size--;
+
+			return true;
+		}
+
+		/**
+		 * Remove the last element
+		 *
+		 * @return True on success, false if empty
+		 */
+		bool pop_back()
+		{
+			AbortIf(_size == 0, false);
+
+			ContainerVersion::Writer change(_version);
+
+			_size--;
+			return true;
+		}
+
+		/**
+		 * Remove all elements, keeping the storage
+		 */
+		void clear()
+		{
+			ContainerVersion::Writer change(_version);
+
+			_head = 0;
+			_size = 0;
+		}
+
+		/**
+		 * Remove all elements and return the storage to the pool.
+		 * Do this before the deque itself goes away
+		 *
+		 * @param[in] pool The pool the deque allocates from
+		 */
+		void release(MemoryManager& pool)
+		{
+			ContainerVersion::Writer change(_version);
+
+			if (_data)
+				pool.free_ptr(_data.get());
+
+			_capacity = 0;
+			_data     = NULL;
+			_head     = 0;
+			_size     = 0;
+		}
+
+	private:
+
+		bool _make_room(MemoryManager& pool)
+		{
+			if (_size < _capacity)
+				return true;
+
+			return _reserve(pool, _capacity ? 2*_capacity : 8);
+		}
+
+		bool _reserve(MemoryManager& pool, size_t count)
+		{
+			if (count <= _capacity)
+				return true;
+
+			AbortIf(count > SIZE_MAX / sizeof(T), false);
+
+			void* addr = pool.allocate_ptr(count * sizeof(T),
+				alignof(T));
+			AbortIfNot(addr, false);
+
+			/*
+			 * Unwrap: the part from the head to the end of the
+			 * ring, then the part that wrapped around
+			 */
+			const size_t first = std::min(_size, _capacity - _head);
+
+			if (first > 0)
+				std::memcpy(addr, _data.get() + _head,
+							first * sizeof(T));
+			if (_size > first)
+				std::memcpy(static_cast<T*>(addr) + first, _data.get(),
+							(_size - first) * sizeof(T));
+
+			if (_data)
+				pool.free_ptr(_data.get());
+
+			_capacity = count;
+			_data     = static_cast<T*>(addr);
+			_head     = 0;
+
+			return true;
+		}
+
+		size_t _slot(size_t index) const
+		{
+			const size_t slot = _head + index;
+			return slot < _capacity ? slot : slot - _capacity;
+		}
+
+		size_t           _capacity;
+		OffsetPtr<T>     _data;
+		size_t           _head;
+		size_t           _size;
+		ContainerVersion _version;
+	};
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class StringHeap
+	 *
+	 * A table of strings in a segment, each stored once. \ref intern()
+	 * returns the same ID for equal strings, so a record in shared
+	 * memory can refer to a string by a 32-bit ID and compare strings
+	 * by comparing IDs. IDs are offsets into the heap's storage, and
+	 * stay the same when it grows
+	 *
+	 * The hash table used for interning is in the segment too, so
+	 * readers can \ref find() the ID of a string as well as look up
+	 * the string for an ID. Strings are NUL-terminated in place, and
+	 * iterating the heap visits each one in the order it was added.
+	 * Readers that don't hold the segment lock use \ref copy_id()
+	 * and \ref copy() instead
+	 *
+	 ******************************************************************
+	 */
+	class StringHeap
+	{
+		/*
+		 * Each string is stored as its length, its characters and a
+		 * NUL, padded to a multiple of the length's size
+		 */
+		typedef uint32_t length_t;
+
+	public:
+
+		typedef uint32_t id_t;
+
+		/**
+		 * The ID returned when a string isn't found
+		 */
+		static const id_t npos = UINT32_MAX;
+
+		/**
+		 * Iterates the strings in the order they were added
+		 */
+		class const_iterator
+		{
+
+		public:
+
+			typedef const char*               value_type;
+			typedef std::ptrdiff_t            difference_type;
+			typedef const char* const*        pointer;
+			typedef const char*               reference;
+			typedef std::forward_iterator_tag iterator_category;
+
+			const_iterator(const StringHeap* heap, id_t id)
+				: _heap(heap), _id(id)
+			{
+			}
+
+			const char* operator*() const
+			{
+				return _heap->str(_id);
+			}
+
+			/**
+			 * Get the ID of the current string
+			 */
+			id_t id() const
+			{
+				return _id;
+			}
+
+			const_iterator& operator++()
+			{
+				_id += _entry_size(_heap->length(_id));
+				return *this;
+			}
+
+			const_iterator operator++(int)
+			{
+				const_iterator old(*this);
+				++*this;
+				return old;
+			}
+
+			bool operator==(const const_iterator& other) const
+			{
+				return _id == other._id;
+			}
+
+			bool operator!=(const const_iterator& other) const
+			{
+				return _id != other._id;
+			}
+
+		private:
+
+			const StringHeap* _heap;
+			id_t _id;
+		};
+
+		/**
+		 * Constructor
+		 */
+		StringHeap()
+			: _bytes(), _capacity(0), _count(0), _slot_count(0),
+			  _slots(), _used(0), _version()
+		{
+		}
+
+		StringHeap(const StringHeap&) = delete;
+		StringHeap& operator=(const StringHeap&) = delete;
+
+		const_iterator begin() const
+		{
+			return const_iterator(this, 0);
+		}
+
+		const_iterator end() const
+		{
+			return const_iterator(this, static_cast<id_t>(_used));
+		}
+
+		/**
+		 * Get the ID of a string, adding it if it isn't there yet
+		 *
+		 * @param[in]  pool   The pool the heap allocates from
+		 * @param[in]  str    The string
+		 * @param[in]  length Its length
+		 * @param[out] id     The string's ID
+		 *
+		 * @return True on success
+		 */
+		bool intern(MemoryManager& pool, const char* str, size_t length,
+					id_t& id)
+		{
+			const uint64_t hash = _hash(str, length);
+
+			id = _find(str, length, hash);
+			if (id != npos)
+				return true;
+
+			AbortIf(length >= UINT32_MAX, false);
+
+			ContainerVersion::Writer change(_version);
+
+			/*
+			 * Keep the table at most 3/4 full
+			 */
+			if ((_count + 1) * 4 > _slot_count * 3)
+			{
+				AbortIfNot(_rehash(pool, _slot_count ?
+					2*_slot_count : 64), false);
+			}
+
+			const size_t need = _used + _entry_size(length);
+			AbortIf(need >= npos, false);
+
+			if (need > _capacity)
+			{
+				AbortIfNot(_regrow(pool, _bytes, _used,
+					std::max(need, 2*_capacity)), false);
+
+				_capacity = std::max(need, 2*_capacity);
+			}
+
+			id = static_cast<id_t>(_used);
+
+			char* entry = _bytes.get() + _used;
+			const length_t stored = static_cast<length_t>(length);
+
+			std::memcpy(entry, &stored, sizeof(stored));
+			std::memcpy(entry + sizeof(stored), str, length);
+			entry[sizeof(stored) + length] = '\0';
+
+			_used = need;
+
+			_insert(id, hash);
+			_count++;
+
+			return true;
+		}
+
+		bool intern(MemoryManager& pool, const std::string& str,
+					id_t& id)
+		{
+			return intern(pool, str.data(), str.size(), id);
+		}
+
+		/**
+		 * Get the ID of a string, if it's in the heap
+		 *
+		 * @param[in] str    The string
+		 * @param[in] length Its length
+		 *
+		 * @return The ID, or \ref npos
+		 */
+		id_t find(const char* str, size_t length) const
+		{
+			return _find(str, length, _hash(str, length));
+		}
+
+		id_t find(const std::string& str) const
+		{
+			return find(str.data(), str.size());
+		}
+
+		/**
+		 * Get the ID of a string without holding the segment lock,
+		 * as a read-only client must
+		 *
+		 * @param[in]  str    The string
+		 * @param[in]  length Its length
+		 * @param[out] id     The ID, or \ref npos if it isn't there
+		 *
+		 * @return True on success
+		 */
+		bool copy_id(const char* str, size_t length, id_t& id) const
+		{
+			const uint64_t hash = _hash(str, length);
+
+			return _version.read([&]() {
+				return _probe(str, length, hash, id);
+			});
+		}
+
+		bool copy_id(const std::string& str, id_t& id) const
+		{
+			return copy_id(str.data(), str.size(), id);
+		}
+
+		/**
+		 * Copy a string out by its ID without holding the segment
+		 * lock, as a read-only client must
+		 *
+		 * @param[in]  id  An ID from \ref intern() or \ref copy_id()
+		 * @param[out] str The string
+		 *
+		 * @return True on success
+		 */
+		bool copy(id_t id, std::string& str) const
+		{
+			return _version.read([&]() {
+				if (!_valid(id))
+					return false;
+
+				str.assign(this->str(id), length(id));
+				return true;
+			});
+		}
+
+		/**
+		 * Get a string by its ID
+		 *
+		 * @param[in] id An ID from \ref intern() or \ref find()
+		 *
+		 * @return The NUL-terminated string, in place
+		 */
+		const char* str(id_t id) const
+		{
+			return _bytes.get() + id + sizeof(length_t);
+		}
+
+		/**
+		 * Get the length of a string by its ID
+		 *
+		 * @param[in] id An ID from \ref intern() or \ref find()
+		 *
+		 * @return The length, not counting the NUL
+		 */
+		size_t length(id_t id) const
+		{
+			length_t length;
+			std::memcpy(&length, _bytes.get() + id, sizeof(length));
+
+			return length;
+		}
+
+		/**
+		 * Get the number of distinct strings
+		 *
+		 * @return The count
+		 */
+		size_t count() const
+		{
+			return _count;
+		}
+
+		/**
+		 * Get the number of bytes the strings take up
+		 *
+		 * @return The size, including lengths and padding
+		 */
+		size_t bytes() const
+		{
+			return _used;
+		}
+
+		/**
+		 * Remove all strings and return the storage to the pool. Do
+		 * this before the heap itself goes away
+		 *
+		 * @param[in] pool The pool the heap allocates from
+		 */
+		void release(MemoryManager& pool)
+		{
+			ContainerVersion::Writer change(_version);
+
+			if (_bytes) pool.free_ptr(_bytes.get());
+			if (_slots) pool.free_ptr(_slots.get());
+
+			_bytes      = NULL;
+			_capacity   = 0;
+			_count      = 0;
+			_slot_count = 0;
+			_slots      = NULL;
+			_used       = 0;
+		}
+
+	private:
+
+		static size_t _entry_size(size_t length)
+		{
+			const size_t size = sizeof(length_t) + length + 1;
+			return (size + sizeof(length_t) - 1) /
+				sizeof(length_t) * sizeof(length_t);
+		}
+
+		/*
+		 * FNV-1a
+		 */
+		static uint64_t _hash(const char* str, size_t length)
+		{
+			uint64_t hash = 14695981039346656037ull;
+
+			for (size_t i = 0; i < length; i++)
+			{
+				hash ^= static_cast<unsigned char>(str[i]);
+				hash *= 1099511628211ull;
+			}
+
+			return hash;
+		}
+
+		id_t _find(const char* str, size_t length, uint64_t hash) const
+		{
+			id_t id;
+			_probe(str, length, hash, id);
+
+			return id;
+		}
+
+		/*
+		 * Slots hold an ID plus one, so that zero-filled slots are
+		 * empty. Collisions probe linearly. Everything read is
+		 * checked before it's followed, and false returned if it
+		 * doesn't add up, which can only happen to a reader racing
+		 * with a change
+		 */
+		bool _probe(const char* str, size_t length, uint64_t hash,
+					id_t& id) const
+		{
+			id = npos;
+
+			const size_t slot_count = _slot_count;
+			const id_t*  slots      = _slots.get();
+
+			if (slot_count == 0)
+				return true;
+
+			if (slots == NULL || (slot_count & (slot_count - 1)) != 0)
+				return false;
+
+			const size_t mask = slot_count - 1;
+
+			size_t i = hash & mask;
+			for (size_t n = 0; n < slot_count; n++, i = (i + 1) & mask)
+			{
+				const id_t slot = slots[i];
+				if (slot == 0)
+					return true;
+
+				if (!_valid(slot - 1))
+					return false;
+
+				if (this->length(slot - 1) == length &&
+					std::memcmp(this->str(slot - 1), str, length) == 0)
+				{
+					id = slot - 1;
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		/*
+		 * Check that an ID refers to a whole string
+		 */
+		bool _valid(id_t id) const
+		{
+			const size_t used = _used;
+
+			if (!_bytes || used > _capacity || id >= used ||
+					used - id < sizeof(length_t))
+				return false;
+
+			return _entry_size(length(id)) <= used - id;
+		}
+
+		void _insert(id_t id, uint64_t hash)
+		{
+			const size_t mask = _slot_count - 1;
+
+			size_t i = hash & mask;
+			while (_slots.get()[i] != 0)
+				i = (i + 1) & mask;
+
+			_slots.get()[i] = id + 1;
+		}
+
+		bool _rehash(MemoryManager& pool, size_t slot_count)
+		{
+			AbortIf(slot_count > SIZE_MAX / sizeof(id_t), false);
+
+			void* addr = pool.allocate_ptr(slot_count * sizeof(id_t),
+				alignof(id_t));
+			AbortIfNot(addr, false);
+
+			std::memset(addr, 0, slot_count * sizeof(id_t));
+
+			if (_slots)
+				pool.free_ptr(_slots.get());
+
+			_slots      = static_cast<id_t*>(addr);
+			_slot_count = slot_count;
+
+			for (const_iterator iter = begin(); iter != end(); ++iter)
+			{
+				_insert(iter.id(),
+					_hash(*iter, length(iter.id())));
+			}
+
+			return true;
+		}
+
+		OffsetPtr<char>  _bytes;
+		size_t           _capacity;
+		size_t           _count;
+		size_t           _slot_count;
+		OffsetPtr<id_t>  _slots;
+		size_t           _used;
+		ContainerVersion _version;
+	};
+}
+
+#endif
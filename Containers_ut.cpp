@@ -0,0 +1,167 @@
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Containers.h"
+
+/*
+ * Checks that a read-only client copies consistent snapshots out of
+ * containers that a writer in another process keeps changing. Exits
+ * with the number of failures
+ */
+
+using namespace SharedMemory;
+
+const char*  segment_name = "/containers_ut";
+const size_t segment_size = 1 << 20;
+
+/*
+ * How long the reader keeps reading
+ */
+const long read_ms = 500;
+
+struct Book
+{
+	SharedVector<uint64_t> counts;
+	SharedDeque<uint64_t>  window;
+	StringHeap             symbols;
+};
+
+bool check(bool ok, const char* what)
+{
+	std::printf("%s: %s\n", ok ? "passed" : "FAILED", what);
+	return ok;
+}
+
+uint64_t now_ms()
+{
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+std::string symbol(uint64_t i)
+{
+	return "symbol-" + std::to_string(i);
+}
+
+/*
+ * Keep changing the containers, in place and in ways that move and
+ * free their storage. The vector's elements are always all equal,
+ * and the deque holds consecutive numbers. Returns the reader's exit
+ * status
+ */
+int write(Book& book, MemoryManager& pool, pid_t reader)
+{
+	uint64_t next = 0, round = 0, symbols = 0;
+	int status;
+
+	while (::waitpid(reader, &status, WNOHANG) == 0)
+	{
+		for (int i = 0; i < 100; i++)
+		{
+			{
+				ContainerVersion::Writer change(book.counts.version());
+
+				round++;
+				for (uint64_t& count : book.counts)
+					count = round;
+			}
+
+			if (book.counts.size() < 2000)
+				book.counts.push_back(pool, round);
+			else
+				book.counts.release(pool);
+
+			book.window.push_back(pool, next++);
+			if (book.window.size() > 300)
+				book.window.pop_front();
+			if (next % 5000 == 0)
+				book.window.release(pool);
+
+			StringHeap::id_t id;
+			if (symbols < 5000)
+				book.symbols.intern(pool, symbol(symbols++), id);
+		}
+	}
+
+	return status;
+}
+
+/*
+ * Take snapshots for a while, and exit non-zero if any is
+ * inconsistent
+ */
+int read()
+{
+	MemoryClient client;
+	int id;
+
+	if (!client.attach(segment_name, read_only, segment_size, id))
+		return 1;
+
+	const Book& book = *static_cast<const Book*>(client.data(id));
+
+	std::vector<uint64_t> out(4096);
+	std::string str;
+	size_t count;
+
+	const uint64_t stop = now_ms() + read_ms;
+	for (uint64_t i = 0; now_ms() < stop; i++)
+	{
+		if (!book.counts.copy(out.data(), out.size(), count))
+			return 2;
+
+		for (size_t j = 1; j < count; j++)
+			if (out[j] != out[0])
+				return 3;
+
+		if (!book.window.copy(out.data(), out.size(), count))
+			return 4;
+
+		for (size_t j = 1; j < count; j++)
+			if (out[j] != out[j-1] + 1)
+				return 5;
+
+		StringHeap::id_t sym;
+		if (!book.symbols.copy_id(symbol(i % 5000), sym))
+			return 6;
+
+		if (sym != StringHeap::npos &&
+				(!book.symbols.copy(sym, str) || str != symbol(i % 5000)))
+			return 7;
+	}
+
+	return 0;
+}
+
+int main()
+{
+	::shm_unlink(segment_name);
+
+	RemoteMemory mem;
+	if (!mem.create(segment_name, read_write, segment_size))
+		return 1;
+
+	Book* book = new (mem.data()) Book();
+
+	MemoryManager pool;
+	if (!pool.init(static_cast<char*>(mem.data()) + sizeof(Book),
+			segment_size - sizeof(Book)))
+		return 1;
+
+	std::fflush(stdout);
+
+	const pid_t reader = ::fork();
+	if (reader == 0)
+		::_exit(read());
+
+	const int status = write(*book, pool, reader);
+
+	return !check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+		"a read-only client copies consistent snapshots");
+}
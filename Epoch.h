@@ -0,0 +1,221 @@
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+#include "Futex.h"
+
+namespace SharedMemory
+{
+	/**
+	 ******************************************************************
+	 *
+	 * @class EpochTable
+	 *
+	 * Epoch-based reclamation shared by every process mapping a
+	 * segment. Readers bracket each access to a lock-free structure
+	 * with \ref enter() and \ref exit(). A writer that unlinks a node
+	 * retires it at the current epoch, and may only free it once no
+	 * process could still be reading at that epoch
+	 *
+	 * Each process owns one slot, packing the number of its threads
+	 * currently inside a critical section with the oldest epoch any
+	 * of them entered at. Slots of processes that have died are
+	 * cleared while computing the safe epoch, so a crashed reader
+	 * can't hold reclamation back forever
+	 *
+	 * Zero-filled memory is a valid, empty table
+	 *
+	 ******************************************************************
+	 */
+	class EpochTable
+	{
+		struct alignas(64) Slot
+		{
+			std::atomic<uint32_t> pid;   /*!< Owning process, or 0 */
+			std::atomic<uint64_t> state; /*!< Count and epoch      */
+		};
+
+		static const int      count_shift = 48;
+		static const uint64_t epoch_mask  =
+			(uint64_t(1) << count_shift) - 1;
+
+	public:
+
+		/**
+		 * The maximum number of processes that may use the table
+		 */
+		static const size_t max_processes = 64;
+
+		/**
+		 * Enter a read-side critical section. Nodes retired from
+		 * now on won't be freed until this thread calls \ref exit()
+		 *
+		 * @return False if there are no free slots
+		 */
+		bool enter()
+		{
+			Slot* slot = _slot(Futex::self());
+			if (slot == NULL)
+				return false;
+
+			const uint64_t epoch =
+				_global.load(std::memory_order_acquire);
+
+			uint64_t cur = slot->state.load(std::memory_order_relaxed);
+			uint64_t next;
+			do
+			{
+				const uint64_t count = cur >> count_shift;
+				const uint64_t oldest = count == 0 ? epoch :
+					std::min(cur & epoch_mask, epoch);
+
+				next = ((count+1) << count_shift) | oldest;
+			} while (!slot->state.compare_exchange_weak(cur, next,
+						std::memory_order_relaxed));
+
+			/*
+			 * Our epoch must be visible before we read any shared
+			 * pointers
+			 */
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			return true;
+		}
+
+		/**
+		 * Leave a read-side critical section
+		 */
+		void exit()
+		{
+			Slot* slot = _slot(Futex::self());
+			if (slot == NULL)
+				return;
+
+			uint64_t cur = slot->state.load(std::memory_order_relaxed);
+			uint64_t next;
+			do
+			{
+				const uint64_t count = cur >> count_shift;
+				next = count <= 1 ? 0 :
+					((count-1) << count_shift) | (cur & epoch_mask);
+			} while (!slot->state.compare_exchange_weak(cur, next,
+						std::memory_order_release,
+						std::memory_order_relaxed));
+		}
+
+		/**
+		 * Get the global epoch, which is what nodes retired right
+		 * now are tagged with
+		 *
+		 * @return The current epoch
+		 */
+		uint64_t current() const
+		{
+			return _global.load(std::memory_order_acquire);
+		}
+
+		/**
+		 * Advance the global epoch, provided every active reader has
+		 * caught up with it
+		 *
+		 * @return True if the epoch moved forward
+		 */
+		bool advance()
+		{
+			uint64_t epoch = current();
+			if (_oldest(epoch) != epoch)
+				return false;
+
+			return _global.compare_exchange_strong(epoch, epoch+1,
+				std::memory_order_acq_rel);
+		}
+
+		/**
+		 * Get the oldest epoch at which some live process may still
+		 * be reading. Nodes retired at earlier epochs can be freed
+		 *
+		 * @return The safe epoch
+		 */
+		uint64_t safe_epoch()
+		{
+			return _oldest(current());
+		}
+
+	private:
+
+		/*
+		 * The oldest epoch of any active, live reader, or 'epoch'
+		 * if there is none. Dead processes are evicted on the way
+		 */
+		uint64_t _oldest(uint64_t epoch)
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			for (size_t i = 0; i < max_processes; i++)
+			{
+				Slot& slot = _slots[i];
+
+				const uint32_t pid =
+					slot.pid.load(std::memory_order_relaxed);
+				if (pid == 0)
+					continue;
+
+				const uint64_t state =
+					slot.state.load(std::memory_order_acquire);
+
+				if (!Futex::alive(static_cast<pid_t>(pid)))
+				{
+					slot.state.store(0, std::memory_order_relaxed);
+					slot.pid.store(0, std::memory_order_release);
+					continue;
+				}
+
+				if ((state >> count_shift) != 0)
+					epoch = std::min(epoch, state & epoch_mask);
+			}
+
+			return epoch;
+		}
+
+		/*
+		 * Find (or claim) the slot belonging to a process
+		 */
+		Slot* _slot(pid_t pid)
+		{
+			const uint32_t id = static_cast<uint32_t>(pid);
+
+			Slot& home = _slots[id % max_processes];
+			if (home.pid.load(std::memory_order_relaxed) == id)
+				return &home;
+
+			for (size_t i = 1; i < max_processes; i++)
+			{
+				Slot& slot = _slots[(id + i) % max_processes];
+				if (slot.pid.load(std::memory_order_relaxed) == id)
+					return &slot;
+			}
+
+			for (size_t i = 0; i < max_processes; i++)
+			{
+				Slot& slot = _slots[(id + i) % max_processes];
+
+				uint32_t owner = 0;
+				if (slot.pid.compare_exchange_strong(owner, id,
+						std::memory_order_acquire))
+					return &slot;
+			}
+
+			return NULL;
+		}
+
+		std::atomic<uint64_t>
+			 _global;
+		Slot _slots[max_processes];
+	};
+}
+
+#endif
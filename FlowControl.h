@@ -0,0 +1,234 @@
+#ifndef __FLOW_CONTROL_H__
+#define __FLOW_CONTROL_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+#include "Futex.h"
+
+namespace SharedMemory
+{
+	/**
+	 *  What a producer does when it has run out of credits
+	 */
+	typedef enum
+	{
+		flow_off         = 0, /*!< Ignore credits entirely        */
+		flow_block       = 1, /*!< Wait for the consumer to grant
+								   more                           */
+		flow_drop_oldest = 2, /*!< Overwrite the oldest unconsumed
+								   message                        */
+		flow_fail_fast   = 3  /*!< Refuse the write               */
+
+	} flow_t;
+
+	/**
+	 *  A snapshot of the flow control counters of a segment
+	 */
+	struct FlowStats
+	{
+		uint64_t granted;         /*!< Credits granted, in total   */
+		uint64_t consumed;        /*!< Credits used, in total      */
+		uint64_t throttled_ns;    /*!< Time producers spent blocked */
+		uint64_t throttle_events; /*!< Number of times they blocked */
+		uint64_t dropped;         /*!< Unconsumed messages
+									   overwritten                 */
+		uint64_t rejected;        /*!< Writes refused              */
+	};
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class CreditGate
+	 *
+	 * Credit-based back-pressure between the producers and the
+	 * consumer of a segment. The consumer grants credits as it
+	 * finishes with messages, and each write by a producer spends
+	 * one. A producer that runs out reacts according to its \ref
+	 * flow_t policy. Both counters only ever grow, so the number of
+	 * credits left is simply their difference
+	 *
+	 * The gate remembers which process granted credits last. A
+	 * producer blocked for credits gives up once that process is
+	 * gone, rather than wait for a consumer that died
+	 *
+	 * Zero-filled memory is a gate with no credits
+	 *
+	 ******************************************************************
+	 */
+	class CreditGate
+	{
+
+	public:
+
+		/**
+		 * How long a blocked producer sleeps between checks, in
+		 * nanoseconds. Grants wake it up sooner
+		 */
+		static const long poll_ns = 10000000;
+
+		/**
+		 * Grant producers more credits. Called by the consumer
+		 *
+		 * @param[in] credits The number of messages the consumer is
+		 *                    ready to accept
+		 */
+		void grant(uint64_t credits)
+		{
+			_consumer.store(static_cast<uint32_t>(Futex::self()),
+							std::memory_order_relaxed);
+			_granted.fetch_add(credits, std::memory_order_release);
+
+			if (_waiters.load(std::memory_order_seq_cst) != 0)
+			{
+				_wakeup.fetch_add(1, std::memory_order_release);
+				Futex::wake(&_wakeup, INT32_MAX);
+			}
+		}
+
+		/**
+		 * Spend a credit ahead of a write. Called by producers
+		 *
+		 * @param[in]  policy    What to do if there are no credits
+		 *                       left
+		 * @param[out] waited_ns If given, incremented by the time
+		 *                       spent blocked
+		 * @param[out] dropped   If given, set if the write will
+		 *                       overwrite an unconsumed message
+		 *
+		 * @return True if the write may go ahead. With \ref
+		 *         flow_block this is false only if the consumer died
+		 */
+		bool acquire(flow_t policy, uint64_t* waited_ns = NULL,
+					 bool* dropped = NULL)
+		{
+			if (dropped) *dropped = false;
+
+			if (policy == flow_off || _take())
+				return true;
+
+			switch (policy)
+			{
+			case flow_drop_oldest:
+				/*
+				 * The write replaces a message the consumer hasn't
+				 * taken, so the number outstanding doesn't change
+				 */
+				_dropped.fetch_add(1, std::memory_order_relaxed);
+				if (dropped) *dropped = true;
+				return true;
+			case flow_block:
+			{
+				uint64_t elapsed;
+				const bool ok = _block(elapsed);
+
+				if (waited_ns) *waited_ns += elapsed;
+				if (ok)
+					return true;
+			}
+			/* Fall through */
+			default:
+				_rejected.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+		}
+
+		/**
+		 * Get the current counters
+		 *
+		 * @return A snapshot of the counters
+		 */
+		FlowStats stats() const
+		{
+			FlowStats stats;
+			stats.granted  = _granted.load(std::memory_order_relaxed);
+			stats.consumed = _consumed.load(std::memory_order_relaxed);
+			stats.throttled_ns =
+				_throttled_ns.load(std::memory_order_relaxed);
+			stats.throttle_events =
+				_throttle_events.load(std::memory_order_relaxed);
+			stats.dropped  = _dropped.load(std::memory_order_relaxed);
+			stats.rejected = _rejected.load(std::memory_order_relaxed);
+
+			return stats;
+		}
+
+	private:
+
+		bool _take()
+		{
+			uint64_t used = _consumed.load(std::memory_order_relaxed);
+			while (used < _granted.load(std::memory_order_acquire))
+			{
+				if (_consumed.compare_exchange_weak(used, used+1,
+						std::memory_order_relaxed))
+					return true;
+			}
+
+			return false;
+		}
+
+		/*
+		 * Wait for a credit, and take it. Returns false if the
+		 * consumer died first. Until some process has granted
+		 * credits, there is no consumer to check on
+		 */
+		bool _block(uint64_t& elapsed)
+		{
+			const uint64_t start = Futex::now_ns();
+
+			_waiters.fetch_add(1, std::memory_order_seq_cst);
+
+			bool ok = true;
+			while (true)
+			{
+				const uint32_t seq =
+					_wakeup.load(std::memory_order_acquire);
+
+				if (_take())
+					break;
+
+				if (Futex::wait(&_wakeup, seq, poll_ns) != ETIMEDOUT)
+					continue;
+
+				const pid_t consumer = static_cast<pid_t>(
+					_consumer.load(std::memory_order_relaxed));
+
+				if (consumer != 0 && !Futex::alive(consumer))
+				{
+					ok = _take();
+					break;
+				}
+			}
+
+			_waiters.fetch_sub(1, std::memory_order_relaxed);
+
+			elapsed = Futex::now_ns() - start;
+
+			_throttled_ns.fetch_add(elapsed, std::memory_order_relaxed);
+			_throttle_events.fetch_add(1, std::memory_order_relaxed);
+
+			return ok;
+		}
+
+		/*
+		 * The consumer writes one and producers the other, so keep
+		 * them on separate cache lines
+		 */
+		alignas(64) std::atomic<uint64_t>
+							  _granted;
+		std::atomic<uint32_t> _consumer;
+		alignas(64) std::atomic<uint64_t>
+							  _consumed;
+		std::atomic<uint32_t> _wakeup;
+		std::atomic<uint32_t> _waiters;
+		std::atomic<uint64_t> _throttled_ns;
+		std::atomic<uint64_t> _throttle_events;
+		std::atomic<uint64_t> _dropped;
+		std::atomic<uint64_t> _rejected;
+	};
+}
+
+#endif
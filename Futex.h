@@ -0,0 +1,148 @@
+#ifndef __FUTEX_H__
+#define __FUTEX_H__
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <ctime>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace SharedMemory
+{
+	/**
+	 * Thin wrappers around the futex(2) system call. Everything here
+	 * operates on process-shared futex words, i.e. words that live in
+	 * a shared memory object, so FUTEX_PRIVATE_FLAG is never used
+	 */
+	namespace Futex
+	{
+		static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+					  "futex words must be plain 32-bit integers");
+		static_assert(ATOMIC_INT_LOCK_FREE == 2,
+					  "futex words must be lock-free");
+
+		/**
+		 * Issue a raw futex(2) call
+		 *
+		 * @param[in] word    The futex word
+		 * @param[in] op      The futex operation
+		 * @param[in] val     Operation-specific value
+		 * @param[in] timeout Optional relative timeout
+		 *
+		 * @return The result of the system call
+		 */
+		inline long call(std::atomic<uint32_t>* word, int op, uint32_t val,
+						 const struct timespec* timeout = NULL)
+		{
+			return ::syscall(SYS_futex,
+							 reinterpret_cast<uint32_t*>(word), op, val,
+							 timeout, NULL, 0);
+		}
+
+		/**
+		 * Sleep until \a word is woken, provided it still contains
+		 * \a expected
+		 *
+		 * @param[in] word     The futex word
+		 * @param[in] expected The value we expect \a word to hold
+		 * @param[in] nsec     Give up after this many nanoseconds
+		 *
+		 * @return 0 if woken (or spuriously returned), ETIMEDOUT if
+		 *         the timeout expired
+		 */
+		inline int wait(std::atomic<uint32_t>* word, uint32_t expected,
+						long nsec)
+		{
+			struct timespec timeout;
+			timeout.tv_sec  = nsec / 1000000000L;
+			timeout.tv_nsec = nsec % 1000000000L;
+
+			if (call(word, FUTEX_WAIT, expected, &timeout) == -1
+				&& errno == ETIMEDOUT)
+				return ETIMEDOUT;
+
+			return 0;
+		}
+
+		/**
+		 * Wake up to \a count waiters sleeping on \a word
+		 *
+		 * @param[in] word  The futex word
+		 * @param[in] count Maximum number of waiters to wake
+		 */
+		inline void wake(std::atomic<uint32_t>* word, int count)
+		{
+			call(word, FUTEX_WAKE, static_cast<uint32_t>(count));
+		}
+
+		/**
+		 * Read the monotonic clock, e.g. to time a wait
+		 *
+		 * @return The CLOCK_MONOTONIC time, in nanoseconds
+		 */
+		inline uint64_t now_ns()
+		{
+			struct timespec ts;
+			::clock_gettime(CLOCK_MONOTONIC, &ts);
+
+			return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull
+				+ ts.tv_nsec;
+		}
+
+		/**
+		 * Check whether a process is still running. A pid that can't
+		 * be signalled for lack of permissions still counts as alive
+		 *
+		 * @param[in] pid The process ID
+		 *
+		 * @return True if the process exists
+		 */
+		inline bool alive(pid_t pid)
+		{
+			return ::kill(pid, 0) == 0 || errno != ESRCH;
+		}
+
+		/*
+		 * The cached pid of this process. glibc no longer caches it,
+		 * so calling getpid() on every lock would cost a system call
+		 */
+		inline std::atomic<pid_t>& _cached_pid()
+		{
+			static std::atomic<pid_t> pid(0);
+			return pid;
+		}
+
+		inline void _reset_pid()
+		{
+			_cached_pid().store(0, std::memory_order_relaxed);
+		}
+
+		/**
+		 * Get the pid of the calling process, without a system call
+		 * in the common case. This stays correct across fork()
+		 *
+		 * @return The pid
+		 */
+		inline pid_t self()
+		{
+			static const bool registered =
+				::pthread_atfork(NULL, NULL, &_reset_pid) == 0;
+			(void)registered;
+
+			pid_t pid = _cached_pid().load(std::memory_order_relaxed);
+			if (pid == 0)
+			{
+				pid = ::getpid();
+				_cached_pid().store(pid, std::memory_order_relaxed);
+			}
+
+			return pid;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __HOOKS_H__
+#define __HOOKS_H__
+
+#include <cstdint>
+
+/*
+ * In-process hooks on the hot paths are chosen at compile time. To
+ * use them, declare a class with the same static members as NullHooks
+ * and define SHARED_MEMORY_HOOKS to its name before SharedMemory.h is
+ * included, identically in every translation unit:
+ *
+ *  #define SHARED_MEMORY_HOOKS SharedMemory::Bench::HistogramHooks
+ *  #include "Benchmark.h"
+ *  #include "SharedMemory.h"
+ *
+ * begin() is called on entry to each instrumented operation with its
+ * argument, and whatever it returns is handed to end() on exit along
+ * with the result. The default, NullHooks, compiles away entirely
+ */
+
+namespace SharedMemory
+{
+	/**
+	 *  The instrumented operations
+	 */
+	typedef enum
+	{
+		probe_allocate = 0, /*!< MemoryManager::allocate()    */
+		probe_defrag   = 1, /*!< MemoryManager::defrag()      */
+		probe_read     = 2, /*!< RemoteMemory/MemoryClient
+								 read()                      */
+		probe_write    = 3, /*!< RemoteMemory/MemoryClient
+								 write()                     */
+		probe_count    = 4
+
+	} probe_t;
+
+	/**
+	 *  The default hooks, which do nothing
+	 */
+	struct NullHooks
+	{
+		static uint64_t begin(probe_t, uint64_t)
+		{
+			return 0;
+		}
+
+		static void end(probe_t, uint64_t, uint64_t)
+		{
+		}
+	};
+}
+
+#endif
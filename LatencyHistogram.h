@@ -0,0 +1,185 @@
+#ifndef __LATENCY_HISTOGRAM_H__
+#define __LATENCY_HISTOGRAM_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "Tsc.h"
+
+namespace SharedMemory
+{
+	/**
+	 ******************************************************************
+	 *
+	 * @class LatencyHistogram
+	 *
+	 * A fixed-size histogram of latencies measured in TSC ticks (see
+	 * \ref Tsc), cheap enough to update on every read. Each power of
+	 * two is split into 8 linear sub-buckets, so values are kept to
+	 * within 12.5% across the whole 64-bit range. Recording is a
+	 * count of leading zeros and a few increments, with no
+	 * allocation. Ticks are converted to nanoseconds only when
+	 * queried
+	 *
+	 ******************************************************************
+	 */
+	class LatencyHistogram
+	{
+
+	public:
+
+		/**
+		 * The number of buckets kept
+		 */
+		static const size_t buckets = 512;
+
+		/**
+		 * Constructor
+		 */
+		LatencyHistogram()
+		{
+			reset();
+		}
+
+		/**
+		 * Record one latency
+		 *
+		 * @param[in] ticks The latency, in TSC ticks
+		 */
+		void add(uint64_t ticks)
+		{
+			_counts[_index(ticks)]++;
+			_total++;
+			_sum += ticks;
+
+			if (ticks > _max) _max = ticks;
+			if (ticks < _min) _min = ticks;
+		}
+
+		/**
+		 * Forget all recorded latencies
+		 */
+		void reset()
+		{
+			std::memset(_counts, 0, sizeof(_counts));
+			_max   = 0;
+			_min   = UINT64_MAX;
+			_sum   = 0;
+			_total = 0;
+		}
+
+		/**
+		 * Get the number of latencies recorded
+		 *
+		 * @return The count
+		 */
+		uint64_t count() const
+		{
+			return _total;
+		}
+
+		/**
+		 * Get the smallest latency recorded (exactly)
+		 *
+		 * @return The minimum in nanoseconds, or 0 if empty
+		 */
+		double min_ns() const
+		{
+			return _total == 0 ? 0.0 : _to_ns(_min);
+		}
+
+		/**
+		 * Get the largest latency recorded (exactly)
+		 *
+		 * @return The maximum in nanoseconds, or 0 if empty
+		 */
+		double max_ns() const
+		{
+			return _to_ns(_max);
+		}
+
+		/**
+		 * Get the average latency
+		 *
+		 * @return The mean in nanoseconds, or 0 if empty
+		 */
+		double mean_ns() const
+		{
+			return _total == 0 ? 0.0 : _to_ns(_sum) / _total;
+		}
+
+		/**
+		 * Get the latency at a percentile, to within the precision
+		 * of the histogram
+		 *
+		 * @param[in] pct The percentile, between 0 and 100
+		 *
+		 * @return The highest latency equivalent to the one at that
+		 *         percentile, in nanoseconds
+		 */
+		double percentile_ns(double pct) const
+		{
+			if (_total == 0)
+				return 0.0;
+
+			if (pct >= 100.0)
+				return _to_ns(_max);
+
+			uint64_t target = static_cast<uint64_t>(
+				pct / 100.0 * _total + 0.5);
+			if (target < 1) target = 1;
+
+			uint64_t seen = 0;
+			for (size_t i = 0; i < buckets; i++)
+			{
+				seen += _counts[i];
+				if (seen < target)
+					continue;
+
+				const uint64_t high = _highest_equivalent(i);
+				return _to_ns(high < _max ? high : _max);
+			}
+
+			return _to_ns(_max);
+		}
+
+	private:
+
+		static size_t _index(uint64_t ticks)
+		{
+			if (ticks < 8)
+				return static_cast<size_t>(ticks);
+
+			const int octave = 63 - __builtin_clzll(ticks);
+			const uint64_t sub = (ticks >> (octave-3)) & 7;
+
+			return static_cast<size_t>(octave-2) * 8 + sub;
+		}
+
+		static uint64_t _highest_equivalent(size_t index)
+		{
+			if (index < 8)
+				return index;
+
+			const int octave = static_cast<int>(index / 8) + 2;
+			const uint64_t low =
+				(8 + (index % 8)) << (octave-3);
+
+			return low + ((uint64_t(1) << (octave-3)) - 1);
+		}
+
+		static double _to_ns(uint64_t ticks)
+		{
+			return ticks / Tsc::ticks_per_ns();
+		}
+
+		uint64_t _counts[buckets];
+		uint64_t _max;
+		uint64_t _min;
+		uint64_t _sum;
+		uint64_t _total;
+	};
+}
+
+#endif
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Benchmark.h"
+#include "SharedMemory.h"
+
+/*
+ * How the cost of looking up a block or segment by ID grows with the
+ * number of them. MemoryManager finds IDs by walking a list, so its
+ * reads, writes and frees are linear in the number live, while
+ * MemoryClient indexes a table and should stay flat. This measures
+ * both curves so changes to either lookup can be checked against it
+ *
+ *  manager_*  read(), write() and free() of random blocks, with 10 up
+ *             to 1M 64-byte blocks allocated from one MemoryManager
+ *  client_*   read(), write() and destroy() of random segments, with
+ *             1 up to 10k segments attached to one MemoryClient. The
+ *             segments are created by a child process, as they would
+ *             be in practice
+ *
+ * Counts go up by powers of 10. Each case prints one JSON line with
+ * its per-operation percentiles, including the cost of reading the
+ * clock
+ *
+ * usage: lookup_bench [max blocks] [max segments]
+ */
+
+const size_t block_size = 64;
+
+/*
+ * Bound the time spent on each case: at most this many operations,
+ * and fewer as lookups get slower
+ */
+const size_t max_ops    = 100000;
+const size_t min_ops    = 100;
+const size_t op_budget  = 100000000;
+
+size_t ops_for(size_t count)
+{
+	return std::max(min_ops, std::min(max_ops, op_budget / count));
+}
+
+/*
+ * Pick 'n' distinct IDs from 'ids', in random order
+ */
+std::vector<int> sample(std::vector<int> ids, size_t n, std::mt19937& rng)
+{
+	std::shuffle(ids.begin(), ids.end(), rng);
+	if (ids.size() > n) ids.resize(n);
+
+	return ids;
+}
+
+bool run_manager(size_t blocks, std::mt19937& rng)
+{
+	using namespace SharedMemory;
+
+	std::vector<char> pool(blocks * block_size);
+
+	MemoryManager manager;
+	AbortIfNot(manager.init(pool.data(), pool.size()), false);
+
+	std::vector<int> ids(blocks);
+	for (size_t i = 0; i < blocks; i++)
+	{
+		ids[i] = manager.allocate(block_size);
+		AbortIf(ids[i] < 0, false);
+	}
+
+	const size_t ops = ops_for(blocks);
+	const std::string extra = Bench::field("blocks", blocks);
+
+	char buf[block_size] = { 0 };
+	Bench::Histogram read_ns, write_ns, free_ns;
+	Bench::PerfCounters perf;
+
+	perf.start();
+	for (size_t i = 0; i < ops; i++)
+	{
+		const int id = ids[rng() % blocks];
+
+		const uint64_t start = Bench::now_ns();
+		AbortIfNot(manager.read(id, buf, block_size), false);
+		read_ns.add(Bench::now_ns() - start);
+	}
+	perf.stop();
+	const std::string read_perf = perf.fields(ops);
+
+	perf.start();
+	for (size_t i = 0; i < ops; i++)
+	{
+		const int id = ids[rng() % blocks];
+
+		const uint64_t start = Bench::now_ns();
+		AbortIfNot(manager.write(id, buf, block_size), false);
+		write_ns.add(Bench::now_ns() - start);
+	}
+	perf.stop();
+	const std::string write_perf = perf.fields(ops);
+
+	/*
+	 * Each free shortens the list, so don't free enough to skew
+	 * the count
+	 */
+	const std::vector<int> victims = sample(ids, std::min(ops,
+		std::max<size_t>(blocks / 10, 1)), rng);
+
+	perf.start();
+	for (size_t i = 0; i < victims.size(); i++)
+	{
+		const uint64_t start = Bench::now_ns();
+		AbortIfNot(manager.free(victims[i]), false);
+		free_ns.add(Bench::now_ns() - start);
+	}
+	perf.stop();
+
+	read_ns.report("lookup", "manager_read", extra + read_perf);
+	write_ns.report("lookup", "manager_write", extra + write_perf);
+	free_ns.report("lookup", "manager_free",
+				   extra + perf.fields(victims.size()));
+
+	return true;
+}
+
+bool run_client(size_t segments, std::mt19937& rng)
+{
+	using namespace SharedMemory;
+
+	Bench::SegmentServer<RemoteMemory> server("lookup_bench");
+
+	const bool served = server.start(segments, read_write, block_size);
+
+	bool ok = served;
+
+	if (served)
+	{
+		MemoryClient client;
+		std::vector<int> ids(segments);
+
+		for (size_t i = 0; i < segments && ok; i++)
+		{
+			ok = client.attach(server.name(i), read_write, block_size,
+							   ids[i])
+				&& client.set_sync_writes(ids[i], false);
+		}
+
+		const size_t ops = ops_for(segments);
+		const std::string extra = Bench::field("segments", segments);
+
+		char buf[block_size] = { 0 };
+		Bench::Histogram read_ns, write_ns, destroy_ns;
+		Bench::PerfCounters perf;
+
+		perf.start();
+		for (size_t i = 0; i < ops && ok; i++)
+		{
+			const int id = ids[rng() % segments];
+
+			const uint64_t start = Bench::now_ns();
+			ok = client.read(id, buf, block_size);
+			read_ns.add(Bench::now_ns() - start);
+		}
+		perf.stop();
+		const std::string read_perf = perf.fields(ops);
+
+		perf.start();
+		for (size_t i = 0; i < ops && ok; i++)
+		{
+			const int id = ids[rng() % segments];
+
+			const uint64_t start = Bench::now_ns();
+			ok = client.write(id, buf, block_size);
+			write_ns.add(Bench::now_ns() - start);
+		}
+		perf.stop();
+		const std::string write_perf = perf.fields(ops);
+
+		const std::vector<int> victims = sample(ids, std::min(ops,
+			std::max<size_t>(segments / 10, 1)), rng);
+
+		perf.start();
+		for (size_t i = 0; i < victims.size() && ok; i++)
+		{
+			const uint64_t start = Bench::now_ns();
+			ok = client.destroy(victims[i]);
+			destroy_ns.add(Bench::now_ns() - start);
+		}
+		perf.stop();
+
+		if (ok)
+		{
+			read_ns.report("lookup", "client_read", extra + read_perf);
+			write_ns.report("lookup", "client_write",
+							extra + write_perf);
+			destroy_ns.report("lookup", "client_destroy",
+							  extra + perf.fields(victims.size()));
+		}
+	}
+
+	const bool stopped = server.stop();
+
+	AbortIfNot(ok, false);
+	AbortIfNot(stopped, false);
+
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	size_t max_blocks   = 1000000;
+	size_t max_segments = 10000;
+
+	if (argc > 1)
+		max_blocks   = std::strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		max_segments = std::strtoul(argv[2], NULL, 10);
+
+	if (max_blocks < 1 || max_segments < 1)
+	{
+		std::printf("usage: %s [max blocks] [max segments]\n",
+					argv[0]);
+		return 1;
+	}
+
+	const size_t fit = SharedMemory::Bench::fit_open_files(max_segments);
+	if (fit < max_segments)
+	{
+		max_segments = fit;
+		std::fprintf(stderr, "lookup_bench: open file limit caps "
+			"segments at %zu\n", max_segments);
+	}
+
+	std::mt19937 rng(1);
+
+	for (size_t blocks = 10; blocks <= max_blocks; blocks *= 10)
+		AbortIfNot(run_manager(blocks, rng), 1);
+
+	for (size_t segments = 1; segments <= max_segments; segments *= 10)
+		AbortIfNot(run_client(segments, rng), 1);
+
+	return 0;
+}
@@ -0,0 +1,145 @@
+#ifndef __LOW_LATENCY_H__
+#define __LOW_LATENCY_H__
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "SharedMemory.h"
+
+namespace SharedMemory
+{
+	/**
+	 *  Settings for a thread that needs to access shared memory with
+	 *  consistently low latency
+	 */
+	struct LowLatencyProfile
+	{
+		LowLatencyProfile()
+			: cpu(-1), fifo_priority(0), lock_memory(true),
+			  prefault(true), sync_writes(false)
+		{
+		}
+
+		int  cpu;           /*!< CPU to pin the thread to, or -1    */
+		int  fifo_priority; /*!< SCHED_FIFO priority, or 0 to keep
+								 the current policy                 */
+		bool lock_memory;   /*!< mlockall() the whole process       */
+		bool prefault;      /*!< Fault in every page of a segment
+								 up front                           */
+		bool sync_writes;   /*!< Keep the mlock()/msync() done on
+								 every write                        */
+	};
+
+	/**
+	 * Helpers which apply a \ref LowLatencyProfile
+	 */
+	namespace LowLatency
+	{
+		/**
+		 * Pin the calling thread to a single CPU
+		 *
+		 * @param[in] cpu The CPU number
+		 *
+		 * @return True on success
+		 */
+		inline bool pin_thread(int cpu)
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+
+			return ::pthread_setaffinity_np(::pthread_self(),
+				sizeof(set), &set) == 0;
+		}
+
+		/**
+		 * Switch the calling thread to SCHED_FIFO. This normally
+		 * requires CAP_SYS_NICE
+		 *
+		 * @param[in] priority The real-time priority
+		 *
+		 * @return True on success
+		 */
+		inline bool set_fifo(int priority)
+		{
+			struct sched_param param;
+			param.sched_priority = priority;
+
+			return ::pthread_setschedparam(::pthread_self(),
+				SCHED_FIFO, &param) == 0;
+		}
+
+		/**
+		 * Apply the per-thread and per-process parts of a profile
+		 * to the calling thread
+		 *
+		 * @param[in] profile The settings to apply
+		 *
+		 * @return True on success
+		 */
+		inline bool apply(const LowLatencyProfile& profile)
+		{
+			if (profile.cpu >= 0)
+				AbortIfNot(pin_thread(profile.cpu), false);
+
+			if (profile.fifo_priority > 0)
+				AbortIfNot(set_fifo(profile.fifo_priority), false);
+
+			if (profile.lock_memory)
+				AbortIf(::mlockall(MCL_CURRENT | MCL_FUTURE) == -1,
+					false);
+
+			return true;
+		}
+
+		/**
+		 * Apply a profile to the calling thread and to a segment
+		 * we created
+		 *
+		 * @param[in] profile The settings to apply
+		 * @param[in] mem     The segment
+		 *
+		 * @return True on success
+		 */
+		inline bool apply(const LowLatencyProfile& profile,
+						  RemoteMemory& mem)
+		{
+			AbortIfNot(apply(profile), false);
+
+			if (profile.prefault)
+				AbortIfNot(mem.prefault(), false);
+
+			AbortIfNot(mem.set_sync_writes(profile.sync_writes),
+				false);
+
+			return true;
+		}
+
+		/**
+		 * Apply a profile to the calling thread and to a segment
+		 * we're attached to
+		 *
+		 * @param[in] profile The settings to apply
+		 * @param[in] client  The client
+		 * @param[in] id      The ID of the segment within \a client
+		 *
+		 * @return True on success
+		 */
+		inline bool apply(const LowLatencyProfile& profile,
+						  MemoryClient& client, int id)
+		{
+			AbortIfNot(apply(profile), false);
+
+			if (profile.prefault)
+				AbortIfNot(client.prefault(id), false);
+
+			AbortIfNot(client.set_sync_writes(id, profile.sync_writes),
+				false);
+
+			return true;
+		}
+	}
+}
+
+#endif
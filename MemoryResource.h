@@ -0,0 +1,228 @@
+#ifndef __MEMORY_RESOURCE_H__
+#define __MEMORY_RESOURCE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "OffsetPtr.h"
+#include "SharedMemory.h"
+
+/*
+ * std::pmr needs C++17 and a library that has it
+ */
+#if __cplusplus >= 201703L && defined(__has_include)
+#  if __has_include(<memory_resource>)
+#    include <memory_resource>
+#    define SHARED_MEMORY_PMR 1
+#  endif
+#endif
+
+namespace SharedMemory
+{
+	/**
+	 ******************************************************************
+	 *
+	 * @class OffsetAllocator
+	 *
+	 * A standard allocator that takes memory from a \ref MemoryManager
+	 * and hands it out as \ref OffsetPtr, so that a container built in
+	 * a segment can be read in place by every process that maps it.
+	 * E.g., with the pool over a RemoteMemory's data:
+	 *
+	 *  typedef std::vector<int, OffsetAllocator<int>> Ints;
+	 *
+	 *  MemoryManager pool;
+	 *  pool.init(mem.data(), size);
+	 *
+	 *  void* at = pool.allocate_ptr(sizeof(Ints), alignof(Ints));
+	 *  Ints* ints = new (at) Ints(OffsetAllocator<int>(pool));
+	 *
+	 * Clients that map the segment find the vector at the same offset
+	 * and may read it, but only the process that owns the manager may
+	 * change it: the allocator itself, stored in the container, holds
+	 * a plain pointer to the manager
+	 *
+	 * This relies on the container storing the allocator's pointer
+	 * type rather than raw pointers, which libstdc++ does for
+	 * std::vector and std::deque but not for every container
+	 *
+	 ******************************************************************
+	 */
+	template <typename T>
+	class OffsetAllocator
+	{
+		template <typename U> friend class OffsetAllocator;
+
+	public:
+
+		typedef T                        value_type;
+		typedef OffsetPtr<T>             pointer;
+		typedef OffsetPtr<const T>       const_pointer;
+		typedef OffsetPtr<void>          void_pointer;
+		typedef OffsetPtr<const void>    const_void_pointer;
+		typedef std::size_t              size_type;
+		typedef std::ptrdiff_t           difference_type;
+
+		template <typename U>
+		struct rebind
+		{
+			typedef OffsetAllocator<U> other;
+		};
+
+		/**
+		 * Constructor
+		 *
+		 * @param[in] manager The pool to allocate from
+		 */
+		explicit OffsetAllocator(MemoryManager& manager)
+			: _manager(&manager)
+		{
+		}
+
+		template <typename U>
+		OffsetAllocator(const OffsetAllocator<U>& other)
+			: _manager(other._manager)
+		{
+		}
+
+		/**
+		 * Allocate room for \a n objects
+		 *
+		 * @param[in] n The number of objects
+		 *
+		 * @return The memory. Throws std::bad_alloc if the pool has
+		 *         no room, as standard allocators must
+		 */
+		pointer allocate(size_type n)
+		{
+			if (n > SIZE_MAX / sizeof(T))
+				throw std::bad_alloc();
+
+			void* addr = _manager->allocate_ptr(n * sizeof(T),
+				alignof(T));
+			if (addr == NULL)
+				throw std::bad_alloc();
+
+			return pointer(static_cast<T*>(addr));
+		}
+
+		/**
+		 * Return memory from \ref allocate() to the pool
+		 *
+		 * @param[in] ptr The memory
+		 */
+		void deallocate(pointer ptr, size_type)
+		{
+			_manager->free_ptr(ptr.get());
+		}
+
+		/**
+		 * Get the pool this allocates from
+		 *
+		 * @return The MemoryManager
+		 */
+		MemoryManager& manager() const
+		{
+			return *_manager;
+		}
+
+		template <typename U>
+		bool operator==(const OffsetAllocator<U>& other) const
+		{
+			return _manager == other._manager;
+		}
+
+		template <typename U>
+		bool operator!=(const OffsetAllocator<U>& other) const
+		{
+			return _manager != other._manager;
+		}
+
+	private:
+
+		MemoryManager* _manager;
+	};
+
+#ifdef SHARED_MEMORY_PMR
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class MemoryResource
+	 *
+	 * A std::pmr::memory_resource that takes memory from a \ref
+	 * MemoryManager, so that any pmr container can be built in a
+	 * segment's pool:
+	 *
+	 *  MemoryResource resource(pool);
+	 *  std::pmr::vector<int> ints(&resource);
+	 *
+	 * pmr containers hold raw pointers, including one to the resource,
+	 * so they're only good in the process that built them, e.g. to
+	 * keep a writer's working data in a segment that outlives it. For
+	 * containers other processes read, use \ref OffsetAllocator
+	 *
+	 * Only available when built as C++17 or later
+	 *
+	 ******************************************************************
+	 */
+	class MemoryResource : public std::pmr::memory_resource
+	{
+
+	public:
+
+		/**
+		 * Constructor
+		 *
+		 * @param[in] manager The pool to allocate from
+		 */
+		explicit MemoryResource(MemoryManager& manager)
+			: _manager(manager)
+		{
+		}
+
+		/**
+		 * Get the pool this allocates from
+		 *
+		 * @return The MemoryManager
+		 */
+		MemoryManager& manager() const
+		{
+			return _manager;
+		}
+
+	private:
+
+		void* do_allocate(std::size_t bytes, std::size_t align) override
+		{
+			/*
+			 * A resource must return a distinct block even for
+			 * zero bytes
+			 */
+			void* addr = _manager.allocate_ptr(bytes ? bytes : 1, align);
+			if (addr == NULL)
+				throw std::bad_alloc();
+
+			return addr;
+		}
+
+		void do_deallocate(void* addr, std::size_t,
+						   std::size_t) override
+		{
+			_manager.free_ptr(addr);
+		}
+
+		bool do_is_equal(const std::pmr::memory_resource& other) const
+			noexcept override
+		{
+			return this == &other;
+		}
+
+		MemoryManager& _manager;
+	};
+
+#endif
+}
+
+#endif
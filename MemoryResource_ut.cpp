@@ -0,0 +1,148 @@
+#include <cstdio>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "MemoryResource.h"
+
+/*
+ * Checks MemoryResource and OffsetAllocator over a RemoteMemory
+ * segment. Needs C++17. Exits with the number of failures
+ */
+
+#ifndef SHARED_MEMORY_PMR
+#  error "MemoryResource_ut needs C++17 and <memory_resource>"
+#endif
+
+using namespace SharedMemory;
+
+const char*  segment_name = "/memory_resource_ut";
+const size_t segment_size = 1 << 20;
+
+typedef std::vector<int, OffsetAllocator<int>> Ints;
+
+bool check(bool ok, const char* what)
+{
+	std::printf("%s: %s\n", ok ? "passed" : "FAILED", what);
+	return ok;
+}
+
+/*
+ * Check that an address lies in the segment's data
+ */
+bool inside(const RemoteMemory& mem, const void* addr)
+{
+	const char* base = static_cast<const char*>(mem.data());
+	const char* ptr  = static_cast<const char*>(addr);
+
+	return ptr >= base && ptr < base + segment_size;
+}
+
+/*
+ * pmr containers take all of their memory from the pool
+ */
+bool pmr_containers(RemoteMemory& mem, MemoryManager& pool)
+{
+	MemoryResource resource(pool);
+
+	std::pmr::vector<int> ints(&resource);
+	for (int i = 0; i < 1000; i++)
+		ints.push_back(i);
+
+	std::pmr::string text(200, 'x', &resource);
+
+	std::pmr::map<int, std::pmr::string> names(&resource);
+	for (int i = 0; i < 100; i++)
+		names.emplace(i, std::pmr::string(100, char('a' + i % 26)));
+
+	bool ok = inside(mem, ints.data()) && inside(mem, text.data());
+	for (auto& name : names)
+		ok = ok && inside(mem, &name) && inside(mem, name.second.data());
+
+	long sum = 0;
+	for (int i : ints)
+		sum += i;
+
+	ok = ok && sum == 999 * 1000 / 2 && text.size() == 200
+		&& names.size() == 100
+		&& names[25] == std::pmr::string(100, 'z');
+
+	return check(ok, "pmr vector, string and map live in the segment");
+}
+
+/*
+ * A vector built with OffsetAllocator can be read by a client that
+ * maps the segment at another address
+ */
+bool offset_vector(RemoteMemory& mem, MemoryManager& pool)
+{
+	void* at = pool.allocate_ptr(sizeof(Ints), alignof(Ints));
+	if (at == NULL)
+		return check(false, "OffsetAllocator vector read by a client");
+
+	Ints* ints = new (at) Ints(OffsetAllocator<int>(pool));
+	for (int i = 0; i < 1000; i++)
+		ints->push_back(i);
+
+	const size_t offset = static_cast<char*>(at) -
+		static_cast<char*>(mem.data());
+
+	std::fflush(stdout);
+
+	const pid_t child = ::fork();
+	if (child == 0)
+	{
+		MemoryClient client;
+		int id;
+
+		if (!client.attach(segment_name, read_only, segment_size, id))
+			::_exit(1);
+
+		const char* data = static_cast<const char*>(client.data(id));
+		if (data == mem.data())
+			::_exit(2);
+
+		const Ints* seen = reinterpret_cast<const Ints*>(data + offset);
+
+		long sum = 0;
+		for (int i : *seen)
+			sum += i;
+
+		::_exit(seen->size() == 1000 && sum == 999 * 1000 / 2 ? 0 : 3);
+	}
+
+	int status;
+	::waitpid(child, &status, 0);
+
+	ints->~Ints();
+	pool.free_ptr(at);
+
+	return check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+		"OffsetAllocator vector read by a client");
+}
+
+int main()
+{
+	::shm_unlink(segment_name);
+
+	RemoteMemory mem;
+	if (!mem.create(segment_name, read_write, segment_size))
+		return 1;
+
+	MemoryManager pool;
+	if (!pool.init(mem.data(), segment_size))
+		return 1;
+
+	int failed = 0;
+
+	failed += !pmr_containers(mem, pool);
+	failed += !offset_vector(mem, pool);
+
+	failed += !check(pool.free_bytes() == segment_size,
+		"everything is given back to the pool");
+
+	return failed;
+}
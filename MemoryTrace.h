@@ -0,0 +1,230 @@
+#ifndef __MEMORY_TRACE_H__
+#define __MEMORY_TRACE_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "abort.h"
+
+namespace SharedMemory
+{
+	/**
+	 *  One event in an allocator trace
+	 */
+	struct TraceOp
+	{
+		/**
+		 *  Event types, which double as the tags used in trace files
+		 */
+		enum
+		{
+			allocate = 'a', /*!< arg is the size, id the result   */
+			free     = 'f', /*!< id is the block freed            */
+			defrag   = 'd'  /*!< arg is the number of bytes moved */
+		};
+
+		TraceOp(char _op, int _id, uint64_t _arg)
+			: op(_op), id(_id), arg(_arg)
+		{
+		}
+
+		char     op;  /*!< One of the event types     */
+		int      id;  /*!< Block ID, or -1            */
+		uint64_t arg; /*!< Size or byte count         */
+	};
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class MemoryTrace
+	 *
+	 * A sequence of allocator events which can be recorded from a
+	 * running \ref MemoryManager (see \ref MemoryManager::set_trace())
+	 * and replayed later against a fresh one
+	 *
+	 * On disk a trace is plain text, so that captures can be read and
+	 * edited by hand. The first line gives the pool size, followed by
+	 * one event per line:
+	 *
+	 *  pool <bytes>
+	 *  a <id> <size>
+	 *  f <id>
+	 *  d <bytes moved>
+	 *
+	 * IDs are those returned by the recorded manager; a replay maps
+	 * them onto whatever its own manager returns
+	 *
+	 ******************************************************************
+	 */
+	class MemoryTrace
+	{
+
+	public:
+
+		/**
+		 * Constructor
+		 *
+		 * @param[in] pool The size of the memory pool traced
+		 */
+		explicit MemoryTrace(size_t pool = 0)
+			: _ops(), _pool(pool)
+		{
+		}
+
+		/**
+		 * Record an event
+		 *
+		 * @param[in] op  The event type
+		 * @param[in] id  The block ID, or -1
+		 * @param[in] arg The size or byte count
+		 */
+		void record(char op, int id, uint64_t arg)
+		{
+			_ops.push_back(TraceOp(op, id, arg));
+		}
+
+		/**
+		 * Forget all events
+		 */
+		void clear()
+		{
+			_ops.clear();
+		}
+
+		/**
+		 * Get the recorded events
+		 *
+		 * @return The events, in order
+		 */
+		const std::vector<TraceOp>& ops() const
+		{
+			return _ops;
+		}
+
+		/**
+		 * Get the size of the pool the trace was taken from
+		 *
+		 * @return The pool size, in bytes
+		 */
+		size_t pool() const
+		{
+			return _pool;
+		}
+
+		/**
+		 * Set the size of the pool the trace was taken from
+		 *
+		 * @param[in] pool The pool size, in bytes
+		 */
+		void set_pool(size_t pool)
+		{
+			_pool = pool;
+		}
+
+		/**
+		 * Read a trace from a file, replacing any events held
+		 *
+		 * @param[in] path The file to read
+		 *
+		 * @return True on success
+		 */
+		bool load(const std::string& path)
+		{
+			FILE* file = std::fopen(path.c_str(), "r");
+			AbortIf(file == NULL, false);
+
+			unsigned long long pool;
+			if (std::fscanf(file, " pool %llu", &pool) != 1)
+			{
+				std::fclose(file);
+				AbortIf(true, false, "%s: missing pool size\n",
+						path.c_str());
+			}
+
+			_pool = static_cast<size_t>(pool);
+			_ops.clear();
+
+			char op;
+			while (std::fscanf(file, " %c", &op) == 1)
+			{
+				int id = -1;
+				unsigned long long arg = 0;
+				int n;
+
+				switch (op)
+				{
+				case TraceOp::allocate:
+					n = std::fscanf(file, "%d %llu", &id, &arg) - 2;
+					break;
+				case TraceOp::free:
+					n = std::fscanf(file, "%d", &id) - 1;
+					break;
+				case TraceOp::defrag:
+					n = std::fscanf(file, "%llu", &arg) - 1;
+					break;
+				default:
+					n = -1;
+				}
+
+				if (n != 0)
+				{
+					std::fclose(file);
+					AbortIf(true, false, "%s: bad event '%c'\n",
+							path.c_str(), op);
+				}
+
+				record(op, id, arg);
+			}
+
+			std::fclose(file);
+			return true;
+		}
+
+		/**
+		 * Write the trace to a file
+		 *
+		 * @param[in] path The file to write
+		 *
+		 * @return True on success
+		 */
+		bool save(const std::string& path) const
+		{
+			FILE* file = std::fopen(path.c_str(), "w");
+			AbortIf(file == NULL, false);
+
+			std::fprintf(file, "pool %llu\n",
+						 static_cast<unsigned long long>(_pool));
+
+			for (size_t i = 0; i < _ops.size(); i++)
+			{
+				const TraceOp& op = _ops[i];
+				const unsigned long long arg = op.arg;
+
+				switch (op.op)
+				{
+				case TraceOp::allocate:
+					std::fprintf(file, "a %d %llu\n", op.id, arg);
+					break;
+				case TraceOp::free:
+					std::fprintf(file, "f %d\n", op.id);
+					break;
+				default:
+					std::fprintf(file, "d %llu\n", arg);
+				}
+			}
+
+			AbortIf(std::fclose(file) != 0, false);
+			return true;
+		}
+
+	private:
+
+		std::vector<TraceOp>
+			   _ops;
+		size_t _pool;
+	};
+}
+
+#endif
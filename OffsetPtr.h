@@ -0,0 +1,264 @@
+#ifndef __OFFSET_PTR_H__
+#define __OFFSET_PTR_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+
+namespace SharedMemory
+{
+	/**
+	 ******************************************************************
+	 *
+	 * @class OffsetPtr
+	 *
+	 * A pointer that stores the distance from itself to its target
+	 * instead of an address. A segment is mapped at a different
+	 * address in each process, so a raw pointer stored in it means
+	 * nothing to the others. An OffsetPtr and its target are both in
+	 * the segment, so the distance between them is the same in every
+	 * process
+	 *
+	 * It follows that an OffsetPtr must live in the same mapping as
+	 * what it points to, and that copying one recomputes the offset
+	 * rather than copying bytes. An offset of 1 means null, since no
+	 * object can start inside the pointer itself
+	 *
+	 * Any standard allocator may use this as its pointer type (see
+	 * \ref OffsetAllocator)
+	 *
+	 ******************************************************************
+	 */
+	template <typename T>
+	class OffsetPtr
+	{
+		template <typename U> friend class OffsetPtr;
+
+	public:
+
+		typedef T                  element_type;
+		typedef T                  value_type;
+		typedef std::ptrdiff_t     difference_type;
+		typedef OffsetPtr          pointer;
+		typedef typename std::add_lvalue_reference<T>::type
+								   reference;
+		typedef std::random_access_iterator_tag
+								   iterator_category;
+
+		/**
+		 * Constructor
+		 *
+		 * @param[in] ptr The target, or NULL
+		 */
+		OffsetPtr(T* ptr = NULL)
+		{
+			_set(ptr);
+		}
+
+		OffsetPtr(std::nullptr_t)
+		{
+			_set(NULL);
+		}
+
+		OffsetPtr(const OffsetPtr& other)
+		{
+			_set(other.get());
+		}
+
+		/**
+		 * Convert from a pointer to a derived or less qualified
+		 * type, as a raw pointer would
+		 */
+		template <typename U, typename = typename std::enable_if<
+			std::is_convertible<U*, T*>::value>::type>
+		OffsetPtr(const OffsetPtr<U>& other)
+		{
+			_set(other.get());
+		}
+
+		/**
+		 * Convert from OffsetPtr<void> and the like, which needs
+		 * a cast with raw pointers, as allocators do
+		 */
+		template <typename U, typename = typename std::enable_if<
+			!std::is_convertible<U*, T*>::value>::type, typename = void>
+		explicit OffsetPtr(const OffsetPtr<U>& other)
+		{
+			_set(static_cast<T*>(other.get()));
+		}
+
+		OffsetPtr& operator=(const OffsetPtr& other)
+		{
+			_set(other.get());
+			return *this;
+		}
+
+		OffsetPtr& operator=(T* ptr)
+		{
+			_set(ptr);
+			return *this;
+		}
+
+		/**
+		 * Get the target's address in this process
+		 *
+		 * @return The address, or NULL
+		 */
+		T* get() const
+		{
+			if (_offset == 1)
+				return NULL;
+
+			return reinterpret_cast<T*>(
+				reinterpret_cast<uintptr_t>(this) + _offset);
+		}
+
+		/**
+		 * Required of an allocator's pointer type
+		 */
+		template <typename U = T>
+		static OffsetPtr pointer_to(
+			typename std::add_lvalue_reference<U>::type ref)
+		{
+			return OffsetPtr(&ref);
+		}
+
+		reference operator*() const
+		{
+			return *get();
+		}
+
+		T* operator->() const
+		{
+			return get();
+		}
+
+		template <typename U = T>
+		typename std::add_lvalue_reference<U>::type
+			operator[](difference_type n) const
+		{
+			return get()[n];
+		}
+
+		explicit operator bool() const
+		{
+			return _offset != 1;
+		}
+
+		OffsetPtr& operator+=(difference_type n)
+		{
+			_set(get() + n);
+			return *this;
+		}
+
+		OffsetPtr& operator-=(difference_type n)
+		{
+			_set(get() - n);
+			return *this;
+		}
+
+		OffsetPtr& operator++()
+		{
+			return *this += 1;
+		}
+
+		OffsetPtr& operator--()
+		{
+			return *this -= 1;
+		}
+
+		OffsetPtr operator++(int)
+		{
+			OffsetPtr old(*this);
+			++*this;
+			return old;
+		}
+
+		OffsetPtr operator--(int)
+		{
+			OffsetPtr old(*this);
+			--*this;
+			return old;
+		}
+
+		friend OffsetPtr operator+(const OffsetPtr& ptr,
+								   difference_type n)
+		{
+			return OffsetPtr(ptr.get() + n);
+		}
+
+		friend OffsetPtr operator+(difference_type n,
+								   const OffsetPtr& ptr)
+		{
+			return OffsetPtr(ptr.get() + n);
+		}
+
+		friend OffsetPtr operator-(const OffsetPtr& ptr,
+								   difference_type n)
+		{
+			return OffsetPtr(ptr.get() - n);
+		}
+
+		friend difference_type operator-(const OffsetPtr& a,
+										 const OffsetPtr& b)
+		{
+			return a.get() - b.get();
+		}
+
+		friend bool operator==(const OffsetPtr& a, const OffsetPtr& b)
+		{
+			return a.get() == b.get();
+		}
+
+		friend bool operator!=(const OffsetPtr& a, const OffsetPtr& b)
+		{
+			return a.get() != b.get();
+		}
+
+		friend bool operator<(const OffsetPtr& a, const OffsetPtr& b)
+		{
+			return a.get() < b.get();
+		}
+
+		friend bool operator>(const OffsetPtr& a, const OffsetPtr& b)
+		{
+			return a.get() > b.get();
+		}
+
+		friend bool operator<=(const OffsetPtr& a, const OffsetPtr& b)
+		{
+			return a.get() <= b.get();
+		}
+
+		friend bool operator>=(const OffsetPtr& a, const OffsetPtr& b)
+		{
+			return a.get() >= b.get();
+		}
+
+		friend bool operator==(const OffsetPtr& a, std::nullptr_t)
+		{
+			return !a;
+		}
+
+		friend bool operator!=(const OffsetPtr& a, std::nullptr_t)
+		{
+			return bool(a);
+		}
+
+	private:
+
+		void _set(const volatile void* ptr)
+		{
+			if (ptr == NULL)
+				_offset = 1;
+			else
+				_offset = reinterpret_cast<uintptr_t>(ptr) -
+					reinterpret_cast<uintptr_t>(this);
+		}
+
+		std::ptrdiff_t _offset;
+	};
+}
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef __PI_MUTEX_H__
+#define __PI_MUTEX_H__
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "Futex.h"
+#include "SharedRWLock.h"
+
+namespace SharedMemory
+{
+	namespace Futex
+	{
+		/*
+		 * The cached kernel thread ID of the calling thread
+		 */
+		inline pid_t& _cached_tid()
+		{
+			static thread_local pid_t tid = 0;
+			return tid;
+		}
+
+		inline void _reset_tid()
+		{
+			_cached_tid() = 0;
+		}
+
+		/**
+		 * Get the kernel thread ID of the calling thread. The PI
+		 * futex protocol identifies owners by thread, not process
+		 *
+		 * @return The thread ID
+		 */
+		inline pid_t tid()
+		{
+			static const bool registered =
+				::pthread_atfork(NULL, NULL, &_reset_tid) == 0;
+			(void)registered;
+
+			pid_t& tid = _cached_tid();
+			if (tid == 0)
+				tid = static_cast<pid_t>(::syscall(SYS_gettid));
+
+			return tid;
+		}
+	}
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class PIMutex
+	 *
+	 * A process-shared mutex using the kernel's priority-inheritance
+	 * futex protocol (FUTEX_LOCK_PI). While a thread is blocked on
+	 * it, the owner runs at the waiter's priority, so a real-time
+	 * thread can't be stalled indefinitely by a low-priority owner
+	 * that is itself preempted by medium-priority work
+	 *
+	 * The futex word holds the owner's thread ID, so an uncontended
+	 * lock or unlock is a single compare-and-swap. Zero-filled memory
+	 * is an unlocked mutex. If the owner dies, the next thread to
+	 * block on the mutex takes it over and gets \ref lock_recovered
+	 *
+	 * No robust list is registered for the mutex, since glibc owns
+	 * the one a thread may have. So the kernel doesn't hand it on
+	 * when the owner dies. It is recovered only when a waiter finds
+	 * that the owner's thread ID no longer exists. If the ID has
+	 * been reused by then, waiters block until that thread exits
+	 *
+	 ******************************************************************
+	 */
+	class PIMutex
+	{
+		static const uint32_t tid_mask = FUTEX_TID_MASK;
+
+		/*
+		 * How long to wait for a dying owner to be gone before
+		 * trying again
+		 */
+		static const long retry_ns = 1000000;
+
+	public:
+
+		/**
+		 * Acquire the mutex, blocking if needed
+		 *
+		 * @param[out] waited If not NULL, the time spent blocked, in
+		 *                    nanoseconds. The clock is only read if
+		 *                    the mutex is contended
+		 *
+		 * @return \ref lock_acquired, \ref lock_recovered if the
+		 *         owner died holding it, or \ref lock_failed if the
+		 *         calling thread already owns it
+		 */
+		lock_status_t lock(uint64_t* waited = NULL)
+		{
+			const uint32_t self = Futex::tid();
+
+			if (waited)
+				*waited = 0;
+
+			uint32_t expected = 0;
+			if (_word.compare_exchange_strong(expected, self,
+					std::memory_order_acquire,
+					std::memory_order_relaxed))
+				return lock_acquired;
+
+			const uint64_t start = Futex::now_ns();
+			const lock_status_t status = _lock_slow(self);
+
+			if (waited)
+				*waited = Futex::now_ns() - start;
+
+			return status;
+		}
+
+		/**
+		 * Acquire the mutex only if that can be done without
+		 * blocking
+		 *
+		 * @return True if the mutex is now held
+		 */
+		bool try_lock()
+		{
+			uint32_t expected = 0;
+			return _word.compare_exchange_strong(expected,
+				static_cast<uint32_t>(Futex::tid()),
+				std::memory_order_acquire,
+				std::memory_order_relaxed);
+		}
+
+		/**
+		 * Release the mutex. If there are waiters, the kernel hands
+		 * it to the highest-priority one
+		 */
+		void unlock()
+		{
+			uint32_t self = Futex::tid();
+			if (_word.compare_exchange_strong(self, 0,
+					std::memory_order_release,
+					std::memory_order_relaxed))
+				return;
+
+			Futex::call(&_word, FUTEX_UNLOCK_PI, 0);
+		}
+
+		/**
+		 * Get the thread holding the mutex, e.g. for a monitoring
+		 * tool. The answer may be stale by the time it's used
+		 *
+		 * @return The owner's thread ID, or 0 if unlocked
+		 */
+		pid_t owner() const
+		{
+			return static_cast<pid_t>(
+				_word.load(std::memory_order_relaxed) & tid_mask);
+		}
+
+		/**
+		 * Check whether any thread is blocked on the mutex
+		 *
+		 * @return True if the kernel has queued waiters
+		 */
+		bool contended() const
+		{
+			return (_word.load(std::memory_order_relaxed)
+				& FUTEX_WAITERS) != 0;
+		}
+
+	private:
+
+		lock_status_t _lock_slow(uint32_t self)
+		{
+			while (true)
+			{
+				/*
+				 * The kernel sets FUTEX_WAITERS, queues us by
+				 * priority and boosts the owner. On return we own
+				 * the mutex
+				 */
+				if (Futex::call(&_word, FUTEX_LOCK_PI, 0) == 0)
+					return lock_acquired;
+
+				const int err = errno;
+				if (err == EINTR || err == EAGAIN)
+					continue;
+
+				if (err != ESRCH)
+					return lock_failed;
+
+				/*
+				 * The owner no longer exists, and with no robust
+				 * list the kernel won't clean up after it, so take
+				 * the word over ourselves. If the mutex was released
+				 * meanwhile, just try again
+				 */
+				uint32_t cur = _word.load(std::memory_order_relaxed);
+				const pid_t owner = static_cast<pid_t>(cur & tid_mask);
+
+				if (owner == 0)
+					continue;
+
+				if (!Futex::alive(owner))
+				{
+					if (_word.compare_exchange_strong(cur,
+							self | (cur & FUTEX_WAITERS),
+							std::memory_order_acquire,
+							std::memory_order_relaxed))
+						return lock_recovered;
+
+					continue;
+				}
+
+				/*
+				 * The owner is still on its way out, so give it
+				 * time to go rather than spin
+				 */
+				struct timespec ts = { 0, retry_ns };
+				::nanosleep(&ts, NULL);
+			}
+		}
+
+		std::atomic<uint32_t> _word;
+	};
+}
+
+#endif
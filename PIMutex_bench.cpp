@@ -0,0 +1,157 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "Benchmark.h"
+#include "LowLatency.h"
+#include "SharedMemory.h"
+
+/*
+ * Classic priority inversion, all on one CPU: a low-priority thread
+ * holds the segment lock for a short critical section, medium-priority
+ * threads burn CPU in long bursts, and a high-priority thread
+ * periodically takes the lock and records how long that took. With the
+ * ordinary lock the low-priority owner can be preempted by the medium
+ * ones, so the high-priority thread's tail latency tracks the length
+ * of a burst. With the PI mutex the owner is boosted and the tail is
+ * bounded by the critical section
+ */
+
+const int low_priority  = 10;
+const int mid_priority  = 20;
+const int high_priority = 30;
+
+const uint64_t critical_ns = 100000;  /* Low-priority hold time   */
+const uint64_t burst_ns    = 2000000; /* Medium-priority CPU burst */
+const int      num_hogs    = 2;
+
+bool lock(SharedMemory::RemoteMemory& mem, bool pi)
+{
+	return pi ? mem.lock_pi() : mem.lock();
+}
+
+bool unlock(SharedMemory::RemoteMemory& mem, bool pi)
+{
+	return pi ? mem.unlock_pi() : mem.unlock();
+}
+
+void run_case(SharedMemory::RemoteMemory& mem, bool pi, int samples,
+			  bool realtime)
+{
+	using namespace SharedMemory;
+
+	std::atomic<bool> done(false);
+
+	std::thread low([&]()
+	{
+		LowLatency::pin_thread(0);
+		if (realtime) LowLatency::set_fifo(low_priority);
+
+		while (!done.load())
+		{
+			lock(mem, pi);
+			Bench::spin_ns(critical_ns);
+			unlock(mem, pi);
+
+			::usleep(200);
+		}
+	});
+
+	std::vector<std::thread> hogs;
+	for (int i = 0; i < num_hogs; i++)
+	{
+		hogs.push_back(std::thread([&]()
+		{
+			LowLatency::pin_thread(0);
+			if (realtime) LowLatency::set_fifo(mid_priority);
+
+			while (!done.load())
+			{
+				Bench::spin_ns(burst_ns);
+				::usleep(3000);
+			}
+		}));
+	}
+
+	Bench::Histogram latency;
+	std::string perf_fields;
+
+	std::thread high([&]()
+	{
+		LowLatency::pin_thread(0);
+		if (realtime) LowLatency::set_fifo(high_priority);
+
+		/*
+		 * Counters follow the thread that opens them
+		 */
+		Bench::PerfCounters perf;
+		perf.start();
+
+		for (int i = 0; i < samples; i++)
+		{
+			::usleep(1000);
+
+			const uint64_t start = Bench::now_ns();
+			lock(mem, pi);
+			latency.add(Bench::now_ns() - start);
+			unlock(mem, pi);
+		}
+
+		perf.stop();
+		perf_fields = perf.fields(samples);
+	});
+
+	high.join();
+	done.store(true);
+
+	low.join();
+	for (size_t i = 0; i < hogs.size(); i++)
+		hogs[i].join();
+
+	latency.report("pi_mutex", pi ? "pi_mutex" : "rw_lock",
+				   perf_fields);
+}
+
+int main(int argc, char** argv)
+{
+	int samples = 2000;
+	if (argc > 1)
+		samples = std::atoi(argv[1]);
+
+	if (samples <= 0)
+	{
+		std::printf("usage: %s [samples]\n", argv[0]);
+		return 1;
+	}
+
+	/*
+	 * Without CAP_SYS_NICE everything runs under the normal
+	 * scheduler and the inversion won't reproduce
+	 */
+	bool realtime = true;
+	std::thread probe([&]()
+	{
+		realtime = SharedMemory::LowLatency::set_fifo(low_priority);
+	});
+	probe.join();
+
+	if (!realtime)
+	{
+		std::fprintf(stderr, "warning: SCHED_FIFO unavailable, "
+			"running at normal priority\n");
+	}
+
+	::shm_unlink("/pi_mutex_bench");
+
+	SharedMemory::RemoteMemory mem;
+	AbortIfNot(mem.create("pi_mutex_bench", SharedMemory::read_write,
+						  64), 1);
+
+	run_case(mem, false, samples, realtime);
+	run_case(mem, true , samples, realtime);
+
+	return 0;
+}
@@ -0,0 +1,265 @@
+#ifndef __PEER_REGISTRY_H__
+#define __PEER_REGISTRY_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/types.h>
+#include <vector>
+
+#include "Futex.h"
+
+namespace SharedMemory
+{
+	/**
+	 *  A snapshot of one process attached to a segment
+	 */
+	struct Peer
+	{
+		pid_t    pid;        /*!< Process ID                        */
+		uint64_t start_time; /*!< Process start time, in clock ticks
+								  since boot                        */
+		uint64_t heartbeat;  /*!< Bumped by each heartbeat          */
+		uint64_t cursor;     /*!< Last position it reported         */
+	};
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class PeerRegistry
+	 *
+	 * Records every process attached to a segment, so that a writer
+	 * can tell a consumer that died from one that is merely slow.
+	 * Each process owns a slot holding its pid and start time (which
+	 * together survive pid reuse), a heartbeat counter and the last
+	 * cursor it reported. Only the owner writes to its slot, so a
+	 * heartbeat is two plain stores
+	 *
+	 * Zero-filled memory is an empty registry
+	 *
+	 ******************************************************************
+	 */
+	class PeerRegistry
+	{
+		struct alignas(64) Slot
+		{
+			std::atomic<uint32_t> pid;
+			std::atomic<uint64_t> start_time;
+			std::atomic<uint64_t> heartbeat;
+			std::atomic<uint64_t> cursor;
+		};
+
+	public:
+
+		/**
+		 * The maximum number of attached processes
+		 */
+		static const size_t max_peers = 64;
+
+		/**
+		 * Register the calling process
+		 *
+		 * @return The slot to pass to \ref heartbeat() and \ref
+		 *         leave(), or -1 if the registry is full
+		 */
+		int join()
+		{
+			const pid_t pid = Futex::self();
+			const uint64_t start = start_time(pid);
+
+			for (size_t i = 0; i < max_peers; i++)
+			{
+				Slot& slot = _slots[i];
+
+				uint32_t owner = 0;
+				if (!slot.pid.compare_exchange_strong(owner,
+						static_cast<uint32_t>(pid),
+						std::memory_order_acquire))
+					continue;
+
+				slot.start_time.store(start, std::memory_order_relaxed);
+				slot.heartbeat.store(0, std::memory_order_relaxed);
+				slot.cursor.store(0, std::memory_order_release);
+
+				return static_cast<int>(i);
+			}
+
+			return -1;
+		}
+
+		/**
+		 * Deregister
+		 *
+		 * @param[in] slot The slot returned by \ref join()
+		 */
+		void leave(int slot)
+		{
+			if (slot < 0 || static_cast<size_t>(slot) >= max_peers)
+				return;
+
+			_slots[slot].start_time.store(0, std::memory_order_relaxed);
+			_slots[slot].pid.store(0, std::memory_order_release);
+		}
+
+		/**
+		 * Signal that the calling process is making progress
+		 *
+		 * @param[in] slot   The slot returned by \ref join()
+		 * @param[in] cursor The caller's current position, e.g. the
+		 *                   last sequence number it consumed
+		 */
+		void heartbeat(int slot, uint64_t cursor)
+		{
+			if (slot < 0 || static_cast<size_t>(slot) >= max_peers)
+				return;
+
+			Slot& self = _slots[slot];
+
+			self.cursor.store(cursor, std::memory_order_relaxed);
+			self.heartbeat.store(
+				self.heartbeat.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
+		}
+
+		/**
+		 * List the registered processes that are still running. This
+		 * costs one kill(pid, 0) per peer; see \ref reap() for a
+		 * check that also catches recycled pids
+		 *
+		 * @param[out] live The live peers
+		 *
+		 * @return The number of live peers
+		 */
+		size_t live(std::vector<Peer>& live) const
+		{
+			live.clear();
+
+			for (size_t i = 0; i < max_peers; i++)
+			{
+				Peer peer;
+				if (_read(_slots[i], peer) && Futex::alive(peer.pid))
+					live.push_back(peer);
+			}
+
+			return live.size();
+		}
+
+		/**
+		 * Look up the process registered in one slot
+		 *
+		 * @param[in]  slot The slot, as returned by \ref join()
+		 * @param[out] peer The process, if any
+		 *
+		 * @return True if the slot is in use
+		 */
+		bool peer(size_t slot, Peer& peer) const
+		{
+			if (slot >= max_peers)
+				return false;
+
+			return _read(_slots[slot], peer);
+		}
+
+		/**
+		 * Free the slots of processes that have exited, including
+		 * those whose pid now belongs to a different process
+		 *
+		 * @return The number of slots freed
+		 */
+		size_t reap()
+		{
+			size_t reaped = 0;
+
+			for (size_t i = 0; i < max_peers; i++)
+			{
+				Peer peer;
+				if (!_read(_slots[i], peer))
+					continue;
+
+				/*
+				 * A start time of 0 means the owner is still in the
+				 * middle of join()
+				 */
+				if (Futex::alive(peer.pid) && (peer.start_time == 0
+					|| start_time(peer.pid) == peer.start_time))
+					continue;
+
+				_slots[i].start_time.store(0, std::memory_order_relaxed);
+
+				uint32_t owner = static_cast<uint32_t>(peer.pid);
+				if (_slots[i].pid.compare_exchange_strong(owner, 0,
+						std::memory_order_acq_rel))
+					reaped++;
+			}
+
+			return reaped;
+		}
+
+		/**
+		 * Get the start time of a process, from /proc/<pid>/stat
+		 *
+		 * @param[in] pid The process ID
+		 *
+		 * @return The start time in clock ticks since boot, or 0 if
+		 *         it couldn't be read
+		 */
+		static uint64_t start_time(pid_t pid)
+		{
+			char path[64];
+			std::snprintf(path, sizeof(path), "/proc/%d/stat",
+						  static_cast<int>(pid));
+
+			FILE* file = std::fopen(path, "r");
+			if (file == NULL)
+				return 0;
+
+			char buf[1024];
+			const size_t n = std::fread(buf, 1, sizeof(buf)-1, file);
+			std::fclose(file);
+			buf[n] = '\0';
+
+			/*
+			 * The command name may contain spaces, so count fields
+			 * from the closing parenthesis. starttime is field 22;
+			 * field 3 follows the parenthesis
+			 */
+			const char* pos = std::strrchr(buf, ')');
+			if (pos == NULL)
+				return 0;
+
+			for (int field = 2; field < 22 && pos != NULL; field++)
+				pos = std::strchr(pos + 1, ' ');
+
+			if (pos == NULL)
+				return 0;
+
+			return std::strtoull(pos + 1, NULL, 10);
+		}
+
+	private:
+
+		bool _read(const Slot& slot, Peer& peer) const
+		{
+			peer.pid = static_cast<pid_t>(
+				slot.pid.load(std::memory_order_acquire));
+			if (peer.pid == 0)
+				return false;
+
+			peer.start_time =
+				slot.start_time.load(std::memory_order_relaxed);
+			peer.heartbeat  =
+				slot.heartbeat.load(std::memory_order_acquire);
+			peer.cursor     =
+				slot.cursor.load(std::memory_order_relaxed);
+
+			return true;
+		}
+
+		Slot _slots[max_peers];
+	};
+}
+
+#endif
@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <sched.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Benchmark.h"
+#include "LowLatency.h"
+#include "SharedMemory.h"
+
+/*
+ * Round-trip latency between two processes. The parent writes a
+ * message to the "ping" segment; the child, which polls that segment
+ * through a MemoryClient, echoes it back through the "pong" segment.
+ * Each side polls the other's write sequence rather than the payload,
+ * since that only moves once a message has been copied in whole
+ *
+ * Payload sizes are swept by powers of 4, ending at the max payload,
+ * first with default settings
+ * and then with a LowLatencyProfile applied to both sides. Each case
+ * prints one JSON line with its round-trip percentiles
+ *
+ * usage: pingpong_bench [iterations] [min payload] [max payload]
+ */
+
+const char* ping_name = "/pingpong_bench_ping";
+const char* pong_name = "/pingpong_bench_pong";
+
+/*
+ * On a single CPU, spinning would just burn the other side's time
+ * slice
+ */
+const bool single_cpu = ::sysconf(_SC_NPROCESSORS_ONLN) < 2;
+
+SharedMemory::LowLatencyProfile profile(int cpu)
+{
+	SharedMemory::LowLatencyProfile profile;
+	profile.cpu = single_cpu ? 0 : cpu;
+
+	return profile;
+}
+
+void wait_for(SharedMemory::MemoryClient& client, int id, uint64_t seq)
+{
+	uint64_t cur = 0;
+	while (client.sequence(id, cur) && cur < seq)
+	{
+		if (single_cpu) ::sched_yield();
+	}
+}
+
+/*
+ * The child: echo every message from ping back through pong
+ */
+int echo(bool tuned, int iterations, size_t payload, int ready_fd)
+{
+	SharedMemory::RemoteMemory pong;
+	AbortIfNot(pong.create(pong_name, SharedMemory::read_write,
+						   payload), 1);
+
+	SharedMemory::MemoryClient client;
+	int ping = 0;
+	AbortIfNot(client.attach(ping_name, SharedMemory::read_only,
+							 payload, ping), 1);
+
+	if (tuned)
+	{
+		SharedMemory::LowLatency::apply(profile(1), pong);
+		SharedMemory::LowLatency::apply(profile(1), client, ping);
+	}
+
+	AbortIf(::write(ready_fd, "x", 1) != 1, 1);
+
+	std::vector<char> msg(payload);
+	for (int i = 1; i <= iterations; i++)
+	{
+		const uint64_t seq = i;
+		wait_for(client, ping, seq);
+
+		AbortIfNot(client.read(ping, msg.data(), payload), 1);
+		AbortIfNot(pong.write(msg.data(), payload), 1);
+	}
+
+	return 0;
+}
+
+bool run(bool tuned, int iterations, size_t payload)
+{
+	::shm_unlink(ping_name);
+	::shm_unlink(pong_name);
+
+	SharedMemory::RemoteMemory ping;
+	AbortIfNot(ping.create(ping_name, SharedMemory::read_write,
+						   payload), false);
+
+	int fds[2];
+	AbortIf(::pipe(fds) == -1, false);
+
+	const pid_t child = ::fork();
+	AbortIf(child == -1, false);
+
+	if (child == 0)
+	{
+		::close(fds[0]);
+		::_exit(echo(tuned, iterations, payload, fds[1]));
+	}
+
+	::close(fds[1]);
+
+	char ready;
+	AbortIf(::read(fds[0], &ready, 1) != 1, false);
+	::close(fds[0]);
+
+	SharedMemory::MemoryClient client;
+	int pong = 0;
+	AbortIfNot(client.attach(pong_name, SharedMemory::read_only,
+							 payload, pong), false);
+
+	if (tuned)
+	{
+		SharedMemory::LowLatency::apply(profile(0), ping);
+		SharedMemory::LowLatency::apply(profile(0), client, pong);
+	}
+
+	SharedMemory::Bench::Histogram rtt;
+	SharedMemory::Bench::PerfCounters perf;
+
+	std::vector<char> msg(payload);
+
+	perf.start();
+	for (int i = 1; i <= iterations; i++)
+	{
+		const uint64_t seq = i;
+
+		const uint64_t start = SharedMemory::Bench::now_ns();
+
+		AbortIfNot(ping.write(msg.data(), payload), false);
+		wait_for(client, pong, seq);
+
+		rtt.add(SharedMemory::Bench::now_ns() - start);
+	}
+	perf.stop();
+
+	int status;
+	::waitpid(child, &status, 0);
+
+	rtt.report("pingpong", tuned ? "tuned" : "default",
+			   SharedMemory::Bench::field("payload", payload)
+			   + perf.fields(iterations));
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	int    iterations  = 10000;
+	size_t min_payload = 8;
+	size_t max_payload = 1 << 20;
+
+	if (argc > 1)
+		iterations  = std::atoi(argv[1]);
+	if (argc > 2)
+		min_payload = std::strtoul(argv[2], NULL, 10);
+	if (argc > 3)
+		max_payload = std::strtoul(argv[3], NULL, 10);
+
+	if (iterations <= 0 || min_payload < 1
+		|| max_payload < min_payload)
+	{
+		std::printf("usage: %s [iterations] [min payload] "
+			"[max payload]\n", argv[0]);
+		return 1;
+	}
+
+	/*
+	 * The tuned runs mlockall() this process for good, so do all
+	 * of the default runs first
+	 */
+	for (int tuned = 0; tuned < 2; tuned++)
+	{
+		for (size_t payload = min_payload; ;
+			 payload = std::min(payload * 4, max_payload))
+		{
+			AbortIfNot(run(tuned, iterations, payload), 1);
+
+			if (payload == max_payload)
+				break;
+		}
+	}
+
+	return 0;
+}
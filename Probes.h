@@ -0,0 +1,126 @@
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+#include <cstdint>
+
+#include "Hooks.h"
+
+/*
+ * USDT probes, for perf and bpftrace, wherever <sys/sdt.h> is found
+ * (on Debian, the systemtap-sdt-dev package). A probe is a single nop
+ * plus a note in the ELF file, so it costs nothing until a tracer
+ * attaches. Define SHARED_MEMORY_NO_USDT to leave them out entirely
+ */
+#if !defined(SHARED_MEMORY_NO_USDT) && defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    include <sys/sdt.h>
+#    define SHARED_MEMORY_USDT 1
+#  endif
+#endif
+
+#ifdef SHARED_MEMORY_USDT
+#  define SHM_USDT(name, arg) \
+	DTRACE_PROBE1(shared_memory, name, arg)
+#else
+#  define SHM_USDT(name, arg) do {} while (0)
+#endif
+
+/*
+ * See Hooks.h for how to supply in-process hooks
+ */
+#ifndef SHARED_MEMORY_HOOKS
+#  define SHARED_MEMORY_HOOKS ::SharedMemory::NullHooks
+#endif
+
+namespace SharedMemory
+{
+	/**
+	 ******************************************************************
+	 *
+	 * @class ProbeScope
+	 *
+	 * Marks one instrumented operation: fires the entry probe and
+	 * hook when constructed, and the return probe and hook when
+	 * destroyed. The probes are named <operation>_entry and
+	 * <operation>_return under the "shared_memory" provider, e.g.
+	 *
+	 *  bpftrace -e 'usdt:./app:shared_memory:write_entry
+	 *               { @bytes = hist(arg0); }'
+	 *
+	 * Entry probes take the size requested (for defrag, the bytes
+	 * free), and return probes the result passed to \ref result():
+	 * the block ID for allocate, the bytes moved for defrag, and 1 or
+	 * 0 for success of read and write
+	 *
+	 ******************************************************************
+	 */
+	template <probe_t P>
+	class ProbeScope
+	{
+
+	public:
+
+		/**
+		 * Constructor
+		 *
+		 * @param[in] arg The operation's argument, usually a size
+		 */
+		explicit ProbeScope(uint64_t arg)
+			: _result(0), _token(SHARED_MEMORY_HOOKS::begin(P, arg))
+		{
+			switch (P)
+			{
+			case probe_allocate: SHM_USDT(allocate_entry, arg); break;
+			case probe_defrag:   SHM_USDT(defrag_entry,   arg); break;
+			case probe_read:     SHM_USDT(read_entry,     arg); break;
+			case probe_write:    SHM_USDT(write_entry,    arg); break;
+			default: break;
+			}
+		}
+
+		/**
+		 * Destructor
+		 */
+		~ProbeScope()
+		{
+			switch (P)
+			{
+			case probe_allocate: SHM_USDT(allocate_return, _result);
+				break;
+			case probe_defrag:   SHM_USDT(defrag_return,   _result);
+				break;
+			case probe_read:     SHM_USDT(read_return,     _result);
+				break;
+			case probe_write:    SHM_USDT(write_return,    _result);
+				break;
+			default: break;
+			}
+
+			SHARED_MEMORY_HOOKS::end(P, _token, _result);
+		}
+
+		/**
+		 * Record the operation's result, to pass on at exit
+		 *
+		 * @param[in] result The result
+		 *
+		 * @return \a result, so this can wrap a return value
+		 */
+		template <typename T>
+		T result(T result)
+		{
+			_result = static_cast<uint64_t>(result);
+			return result;
+		}
+
+		ProbeScope(const ProbeScope&) = delete;
+		ProbeScope& operator=(const ProbeScope&) = delete;
+
+	private:
+
+		uint64_t _result;
+		uint64_t _token;
+	};
+}
+
+#endif
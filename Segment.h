@@ -0,0 +1,579 @@
+#ifndef __SEGMENT_H__
+#define __SEGMENT_H__
+
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+
+#include "abort.h"
+#include "SharedMemory.h"
+
+namespace SharedMemory
+{
+	/**
+	 ******************************************************************
+	 *
+	 * @class Segment
+	 *
+	 * A handle to one shared object created by a \ref RemoteMemory,
+	 * with its access mode fixed at compile time. It does what a
+	 * \ref MemoryClient does for one of its objects, but:
+	 *
+	 *  - Operations that need write access, e.g. write() or lock(),
+	 *    don't compile on a \ref ReadOnlySegment
+	 *  - There is no ID to look up and no permission to check on
+	 *    each call, so read() is a size check and a memcpy()
+	 *  - A read-only mapping is populated up front, since there are
+	 *    no dirty pages to track, so that the first reads don't
+	 *    fault
+	 *
+	 * A read-only handle still writes to the segment header, to
+	 * join the peer registry and count its reads in the stats page,
+	 * unless the object's permissions only let it be opened
+	 * read-only
+	 *
+	 ******************************************************************
+	 */
+	template <access_t Access>
+	class Segment
+	{
+		static_assert(Access == read_only || Access == read_write,
+			"A segment is either read-only or read-write");
+
+		static const bool writable = Access == read_write;
+
+	public:
+
+		/**
+		 * The type of \ref data()
+		 */
+		typedef typename std::conditional<writable, void*,
+			const void*>::type pointer;
+
+		/**
+		 * Constructor
+		 */
+		Segment()
+			: _addr(NULL),
+			  _base(NULL),
+			  _control(false),
+			  _flow(flow_off),
+			  _header(NULL),
+			  _last_seq(0),
+			  _latency(),
+			  _name(""),
+			  _peer_slot(-1),
+			  _size(0),
+			  _sync_writes(true),
+			  _timestamps(false)
+		{
+		}
+
+		/**
+		 * Destructor
+		 */
+		~Segment()
+		{
+			if (_addr) detach();
+		}
+
+		/**
+		 * Move constructor. \a other gives up its attachment
+		 */
+		Segment(Segment&& other) : Segment()
+		{
+			_swap(other);
+		}
+
+		/**
+		 * Move assignment. The attachment this held, if any, is
+		 * detached
+		 */
+		Segment& operator=(Segment&& other)
+		{
+			Segment moved(std::move(other));
+			_swap(moved);
+
+			return *this;
+		}
+
+		Segment(const Segment&) = delete;
+		Segment& operator=(const Segment&) = delete;
+
+		/**
+		 * Attach to a shared memory object
+		 *
+		 * @param[in] name The name of an existing shared memory
+		 *                 object
+		 * @param[in] size Number of bytes to use
+		 *
+		 * @return True on success
+		 */
+		bool attach(const std::string& name, size_t size)
+		{
+			AbortIf(_addr, false);
+			AbortIf(name.size() == 0, false);
+
+			_name = name[0] == '/' ? name : "/" + name;
+
+			const int fd = open_segment(_name, Access);
+			AbortIf(fd == -1, false);
+
+			/*
+			 * Touching a page past the end of the file would raise
+			 * SIGBUS
+			 */
+			struct stat st;
+			if (::fstat(fd, &st) == -1 ||
+				static_cast<size_t>(st.st_size) < data_offset() + size)
+			{
+				::close(fd);
+				AbortIf(true, false, "%s is too small\n",
+					_name.c_str());
+			}
+
+			SegmentHeader* header;
+			const bool ok = map_segment(fd, Access, size,
+				writable ? 0 : MAP_POPULATE, header);
+
+			_control = opened_for_writing(fd);
+			::close(fd);
+
+			AbortIfNot(ok, false, "%s is not a segment\n",
+				_name.c_str());
+
+			_addr   = header;
+			_base   = reinterpret_cast<char*>(header) + data_offset();
+			_header = header;
+			_size   = size;
+
+			if (_control)
+			{
+				_peer_slot = _header->peers.join();
+				_header->stats.reset(_peer_slot);
+			}
+
+			return true;
+		}
+
+		/**
+		 * Unmap the shared object. It stays in place for other
+		 * processes
+		 *
+		 * @return True on success
+		 */
+		bool detach()
+		{
+			AbortIfNot(_addr, false);
+
+			if (_peer_slot >= 0)
+				_header->peers.leave(_peer_slot);
+
+			AbortIf(::munmap(_addr, data_offset() + _size) == -1,
+				false);
+
+			_addr      = NULL;
+			_base      = NULL;
+			_control   = false;
+			_header    = NULL;
+			_peer_slot = -1;
+			return true;
+		}
+
+		/**
+		 * Read data from the shared object
+		 *
+		 * @param[in] buf  The buffer to read into
+		 * @param[in] size The total number of bytes to read
+		 *
+		 * @return True on success
+		 */
+		bool read(void* buf, size_t size) const
+		{
+			ProbeScope<probe_read> probe(size);
+
+			AbortIf(_addr == NULL || size > _size,
+				false);
+
+			const StatsPage& stats = _header->stats;
+			const uint64_t seq = stats.sequence();
+
+			std::memcpy(buf, _data(), size);
+
+			stats.sample(seq, _last_seq, _latency);
+
+			_header->stats.read(_peer_slot, size, seq);
+
+			return probe.result(true);
+		}
+
+		/**
+		 * Write data into the shared object
+		 *
+		 * @param[in] buf  The buffer to write from
+		 * @param[in] size The total number of bytes to write
+		 *
+		 * @return True on success
+		 */
+		bool write(const void* buf, size_t size)
+		{
+			static_assert(writable, "The segment is read-only");
+
+			ProbeScope<probe_write> probe(size);
+
+			AbortIfNot(_addr, false);
+
+			return probe.result(write_segment(_header, _size, buf, size,
+				_flow, _peer_slot, _sync_writes, _timestamps));
+		}
+
+		/**
+		 * Acquire the segment lock for writing. See \ref
+		 * MemoryClient::lock()
+		 *
+		 * @return True on success
+		 */
+		bool lock()
+		{
+			static_assert(writable, "The segment is read-only");
+
+			AbortIfNot(_addr, false);
+			return _header->lock(_peer_slot);
+		}
+
+		/**
+		 * Release the segment lock held for writing
+		 *
+		 * @return True on success
+		 */
+		bool unlock()
+		{
+			static_assert(writable, "The segment is read-only");
+
+			AbortIfNot(_addr, false);
+
+			_header->rwlock.unlock();
+			return true;
+		}
+
+		/**
+		 * Acquire the segment lock for reading. Since this modifies
+		 * the lock, it isn't available read-only
+		 *
+		 * @return True on success
+		 */
+		bool lock_shared()
+		{
+			static_assert(writable, "The segment is read-only");
+
+			AbortIfNot(_addr, false);
+			return _header->lock_shared(_peer_slot);
+		}
+
+		/**
+		 * Release the segment lock held for reading
+		 *
+		 * @return True on success
+		 */
+		bool unlock_shared()
+		{
+			static_assert(writable, "The segment is read-only");
+
+			AbortIfNot(_addr, false);
+
+			_header->rwlock.unlock_shared();
+			return true;
+		}
+
+		/**
+		 * Acquire the segment's priority-inheritance mutex
+		 *
+		 * @return True on success
+		 */
+		bool lock_pi()
+		{
+			static_assert(writable, "The segment is read-only");
+
+			AbortIfNot(_addr, false);
+			return _header->lock_pi(_peer_slot);
+		}
+
+		/**
+		 * Release the segment's priority-inheritance mutex
+		 *
+		 * @return True on success
+		 */
+		bool unlock_pi()
+		{
+			static_assert(writable, "The segment is read-only");
+
+			AbortIfNot(_addr, false);
+
+			_header->pi_mutex.unlock();
+			return true;
+		}
+
+		/**
+		 * Check whether a writer died while holding the lock, in
+		 * which case the data may be half-written
+		 *
+		 * @return True if the data should be validated
+		 */
+		bool needs_validation() const
+		{
+			AbortIfNot(_addr, false);
+
+			return _header->flags.load() &
+				SegmentHeader::needs_validation;
+		}
+
+		/**
+		 * Clear the flag raised by a lock recovery
+		 *
+		 * @return True on success
+		 */
+		bool validated()
+		{
+			static_assert(writable, "The segment is read-only");
+
+			AbortIfNot(_addr, false);
+
+			_header->flags.fetch_and(~SegmentHeader::needs_validation);
+			return true;
+		}
+
+		/**
+		 * Grant credits to the producers, see \ref
+		 * MemoryClient::grant()
+		 *
+		 * @param[in] credits The number of credits to grant
+		 *
+		 * @return True on success
+		 */
+		bool grant(uint64_t credits)
+		{
+			AbortIfNot(_addr, false);
+			AbortIfNot(_control, false);
+
+			_header->flow.grant(credits);
+			return true;
+		}
+
+		/**
+		 * Make \ref write() spend a credit, and choose what happens
+		 * when there are none left
+		 *
+		 * @param[in] policy The flow control policy
+		 *
+		 * @return True on success
+		 */
+		bool set_flow_control(flow_t policy)
+		{
+			static_assert(writable, "The segment is read-only");
+
+			AbortIfNot(_addr, false);
+
+			_flow = policy;
+			return true;
+		}
+
+		/**
+		 * Choose whether \ref write() locks the segment into memory
+		 * and msync()s it on every call
+		 *
+		 * @param[in] sync True to sync on every write (the default)
+		 *
+		 * @return True on success
+		 */
+		bool set_sync_writes(bool sync)
+		{
+			static_assert(writable, "The segment is read-only");
+
+			AbortIfNot(_addr, false);
+
+			_sync_writes = sync;
+			return true;
+		}
+
+		/**
+		 * Choose whether \ref write() stamps each message with the
+		 * TSC, for readers to measure latency
+		 *
+		 * @param[in] enabled True to stamp writes (default false)
+		 *
+		 * @return True on success
+		 */
+		bool set_timestamps(bool enabled)
+		{
+			static_assert(writable, "The segment is read-only");
+
+			AbortIfNot(_addr, false);
+
+			_timestamps = enabled;
+			return true;
+		}
+
+		/**
+		 * Turn the segment's trace ring on or off, for every
+		 * process using it
+		 *
+		 * @param[in] enabled True to record events
+		 *
+		 * @return True on success
+		 */
+		bool set_tracing(bool enabled)
+		{
+			static_assert(writable, "The segment is read-only");
+
+			AbortIfNot(_addr, false);
+
+			_header->ring.enable(enabled);
+			return true;
+		}
+
+		/**
+		 * Signal to the other processes that we're alive
+		 *
+		 * @param[in] cursor Our current position
+		 *
+		 * @return True on success
+		 */
+		bool heartbeat(uint64_t cursor)
+		{
+			AbortIfNot(_addr, false);
+			AbortIf(_peer_slot < 0, false);
+
+			_header->peers.heartbeat(_peer_slot, cursor);
+			return true;
+		}
+
+		/**
+		 * Get the segment's flow control counters
+		 *
+		 * @param[out] stats The counters
+		 *
+		 * @return True on success
+		 */
+		bool flow_stats(FlowStats& stats) const
+		{
+			AbortIfNot(_addr, false);
+
+			stats = _header->flow.stats();
+			return true;
+		}
+
+		/**
+		 * Get the publish-to-read latencies seen by \ref read(), see
+		 * \ref MemoryClient::latency()
+		 *
+		 * @return The histogram
+		 */
+		const LatencyHistogram& latency() const
+		{
+			return _latency;
+		}
+
+		/**
+		 * Forget the latencies recorded
+		 */
+		void reset_latency()
+		{
+			_latency.reset();
+		}
+
+		/**
+		 * Fault in and lock every page of the segment
+		 *
+		 * @return True on success
+		 */
+		bool prefault()
+		{
+			AbortIfNot(_addr, false);
+
+			return SharedMemory::prefault(_addr, data_offset() + _size,
+										  writable);
+		}
+
+		/**
+		 * Get the address of the shared data, for direct access.
+		 * Access through it takes no lock and isn't counted in the
+		 * stats
+		 *
+		 * @return The address, or NULL if not attached
+		 */
+		pointer data() const
+		{
+			return _addr ? _data() : NULL;
+		}
+
+		/**
+		 * Get the number of bytes in use
+		 *
+		 * @return The size given to \ref attach()
+		 */
+		size_t size() const
+		{
+			return _size;
+		}
+
+	private:
+
+		/*
+		 * The start of the data, kept so that reads and writes
+		 * needn't work out data_offset()
+		 */
+		char* _data() const
+		{
+			return _base;
+		}
+
+		void _swap(Segment& other)
+		{
+			std::swap(_addr,        other._addr);
+			std::swap(_base,        other._base);
+			std::swap(_control,     other._control);
+			std::swap(_flow,        other._flow);
+			std::swap(_header,      other._header);
+			std::swap(_last_seq,    other._last_seq);
+			std::swap(_latency,     other._latency);
+			std::swap(_name,        other._name);
+			std::swap(_peer_slot,   other._peer_slot);
+			std::swap(_size,        other._size);
+			std::swap(_sync_writes, other._sync_writes);
+			std::swap(_timestamps,  other._timestamps);
+		}
+
+		void*          _addr;
+		char*          _base;
+		bool           _control;
+		flow_t         _flow;
+		SegmentHeader* _header;
+		mutable uint64_t
+					   _last_seq;
+		mutable LatencyHistogram
+					   _latency;
+		std::string    _name;
+		int            _peer_slot;
+		size_t         _size;
+		bool           _sync_writes;
+		bool           _timestamps;
+	};
+
+	/**
+	 * A handle to a segment that can only be read
+	 */
+	typedef Segment<read_only>  ReadOnlySegment;
+
+	/**
+	 * A handle to a segment that can be read and written
+	 */
+	typedef Segment<read_write> ReadWriteSegment;
+}
+
+#endif
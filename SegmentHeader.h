@@ -0,0 +1,232 @@
+#ifndef __SEGMENT_HEADER_H__
+#define __SEGMENT_HEADER_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <unistd.h>
+
+#include "Epoch.h"
+#include "FlowControl.h"
+#include "PeerRegistry.h"
+#include "PIMutex.h"
+#include "SharedRWLock.h"
+#include "StatsPage.h"
+#include "TraceRing.h"
+
+namespace SharedMemory
+{
+	/**
+	 ******************************************************************
+	 *
+	 * @struct SegmentHeader
+	 *
+	 * Bookkeeping placed at the start of every shared memory object
+	 * created by a \ref RemoteMemory. The user's data follows it at
+	 * offset \ref data_offset(). Clients check the magic
+	 * number and version on attach so that mismatched builds refuse
+	 * to talk to each other instead of misreading the segment
+	 *
+	 ******************************************************************
+	 */
+	struct SegmentHeader
+	{
+		static const uint32_t magic_id   = 0x53484d48; /* "SHMH" */
+		static const uint32_t version_id = 13;
+
+		/**
+		 *  Bits in \ref flags
+		 */
+		enum
+		{
+			needs_validation = 1u << 0 /*!< A writer died holding the
+											lock, so the data may be
+											inconsistent             */
+		};
+
+		/**
+		 * Prepare a freshly truncated (i.e. zero-filled) segment
+		 *
+		 * @param[in] _size   The number of bytes of user data
+		 * @param[in] _layout The hash of its \ref StaticLayout, or 0
+		 */
+		void init(size_t _size, uint64_t _layout = 0)
+		{
+			size    = _size;
+			layout  = _layout;
+			version = version_id;
+			flags.store(0, std::memory_order_relaxed);
+
+			/*
+			 * Publish the magic number last, so that a client never
+			 * accepts a half-initialized header
+			 */
+			std::atomic_thread_fence(std::memory_order_release);
+			magic   = magic_id;
+		}
+
+		/**
+		 * Check that this header was written by a compatible
+		 * \ref RemoteMemory and covers at least \a _size bytes
+		 *
+		 * @param[in] _size The number of bytes of user data expected
+		 *
+		 * @return True if the header is usable
+		 */
+		bool valid(size_t _size) const
+		{
+			return magic == magic_id && version == version_id
+				&& size >= _size;
+		}
+
+		/**
+		 * Acquire the segment lock for writing. If the previous owner
+		 * died holding it, the segment is flagged as needing
+		 * validation
+		 *
+		 * @param[in] slot The caller's peer slot, to charge the wait
+		 *                 to in \ref stats, or -1
+		 *
+		 * @return True on success
+		 */
+		bool lock(int slot = -1)
+		{
+			uint64_t waited;
+			const lock_status_t status = rwlock.lock(&waited);
+
+			return _check(status, slot, true, waited);
+		}
+
+		/**
+		 * Acquire the segment lock for reading
+		 *
+		 * @param[in] slot The caller's peer slot, or -1
+		 *
+		 * @return True on success
+		 */
+		bool lock_shared(int slot = -1)
+		{
+			uint64_t waited;
+			const lock_status_t status = rwlock.lock_shared(&waited);
+
+			return _check(status, slot, false, waited);
+		}
+
+		/**
+		 * Acquire the segment's priority-inheritance mutex. Like
+		 * \ref lock(), a recovery flags the segment
+		 *
+		 * @param[in] slot The caller's peer slot, or -1
+		 *
+		 * @return True on success
+		 */
+		bool lock_pi(int slot = -1)
+		{
+			uint64_t waited;
+			const lock_status_t status = pi_mutex.lock(&waited);
+
+			return _check(status, slot, true, waited);
+		}
+
+		/**
+		 * Start a write: log it, and spend a flow control credit
+		 *
+		 * @param[in]  policy  The writer's flow control policy
+		 * @param[in]  bytes   The message size
+		 * @param[out] waited  Time spent blocked for the credit, in
+		 *                     nanoseconds
+		 * @param[out] dropped True if the write will overwrite an
+		 *                     unconsumed message
+		 *
+		 * @return False if the write must not go ahead
+		 */
+		bool begin_write(flow_t policy, size_t bytes, uint64_t& waited,
+						 bool& dropped)
+		{
+			waited  = 0;
+			dropped = false;
+
+			ring.record(trace_write, bytes);
+
+			if (!flow.acquire(policy, &waited, &dropped))
+				return false;
+
+			if (waited >= TraceRing::wait_threshold_ns)
+				ring.record(trace_wait, waited);
+
+			return true;
+		}
+
+		/**
+		 * Finish a write started by \ref begin_write(), once the
+		 * data is in place: account for it and publish it
+		 *
+		 * @param[in] slot    The writer's peer slot
+		 * @param[in] bytes   The message size
+		 * @param[in] waited  As returned by \ref begin_write()
+		 * @param[in] dropped As returned by \ref begin_write()
+		 * @param[in] stamp   True to stamp the message with the TSC
+		 */
+		void end_write(int slot, size_t bytes, uint64_t waited,
+					   bool dropped, bool stamp)
+		{
+			ring.record(trace_publish, stats.wrote(slot, bytes, waited,
+				dropped, stamp ? Tsc::now() : 0));
+		}
+
+		uint32_t              magic;    /*!< Always \ref magic_id     */
+		uint32_t              version;  /*!< Layout version           */
+		uint64_t              size;     /*!< Bytes of user data       */
+		uint64_t              layout;   /*!< StaticLayout hash of the
+											 data, or 0 if untyped   */
+		std::atomic<uint32_t> flags;    /*!< Status bits              */
+		SharedRWLock          rwlock;   /*!< Guards the user data     */
+		PIMutex               pi_mutex; /*!< Guards the user data, for
+											 real-time users         */
+		EpochTable            epochs;   /*!< Readers' epochs, for
+											 deferred frees          */
+		PeerRegistry          peers;    /*!< Attached processes     */
+		CreditGate            flow;     /*!< Producer back-pressure */
+		StatsPage             stats;    /*!< Per-process traffic    */
+		TraceRing             ring;     /*!< Recent events, when
+											 enabled                 */
+
+	private:
+
+		/*
+		 * Flag a recovery, and charge time spent blocked. The locks
+		 * only time their slow paths, so an uncontended lock touches
+		 * nothing else
+		 */
+		bool _check(lock_status_t status, int slot, bool writer,
+					uint64_t waited)
+		{
+			if (status == lock_recovered)
+				flags.fetch_or(needs_validation,
+							   std::memory_order_relaxed);
+
+			if (slot >= 0 && waited > 0)
+			{
+				stats.waited(slot, writer, waited);
+
+				if (waited >= TraceRing::wait_threshold_ns)
+					ring.record(trace_wait, waited);
+			}
+
+			return status != lock_failed;
+		}
+	};
+
+	/**
+	 * The offset of the user's data within a shared memory object.
+	 * This is kept to a whole page so the data is page-aligned just
+	 * as it would be without a header
+	 */
+	inline size_t data_offset()
+	{
+		static const size_t page = ::sysconf(_SC_PAGESIZE);
+		return (sizeof(SegmentHeader) + page - 1) / page * page;
+	}
+}
+
+#endif
@@ -1,17 +1,54 @@
 #ifndef __SHARED_MEMORY_H__
 #define __SHARED_MEMORY_H__
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <ctime>
 #include <fcntl.h>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <string>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "abort.h"
+#include "LatencyHistogram.h"
+#include "MemoryTrace.h"
+#include "Probes.h"
+#include "SegmentHeader.h"
 
 namespace SharedMemory
 {
+	/**
+	 *  A snapshot of a \ref MemoryManager's bookkeeping
+	 */
+	struct AllocatorStats
+	{
+		size_t   live_blocks;     /*!< Blocks currently allocated   */
+		size_t   free_bytes;      /*!< Bytes not allocated          */
+		size_t   largest_free;    /*!< Largest contiguous free
+									   region, in bytes            */
+		double   fragmentation;   /*!< 1 - largest_free / free_bytes:
+									   0 if free space is contiguous */
+		uint64_t allocations;     /*!< Successful allocate() calls  */
+		uint64_t failed;          /*!< allocate() calls refused     */
+		uint64_t frees;           /*!< Blocks freed                 */
+		uint64_t defrags;         /*!< Times the pool was compacted */
+		uint64_t bytes_compacted; /*!< Bytes moved by compaction    */
+		uint64_t compaction_ns;   /*!< Time spent compacting        */
+	};
+
 	/**
 	 ******************************************************************
 	 *
@@ -35,13 +72,27 @@ namespace SharedMemory
 			Block(int _id, size_t _offset, size_t _size)
 				: id(_id),
 				  offset(_offset),
-				  size(_size)
+				  size(_size),
+				  pinned(false)
+			{
+			}
+
+			int    id;     /*!< Memory block ID           */
+			size_t offset; /*!< Buffer offset             */
+			size_t size;   /*!< Block size                */
+			bool   pinned; /*!< From allocate_ptr(), so it
+							    must not move            */
+		};
+
+		struct Retired
+		{
+			Retired(int _id, uint64_t _epoch)
+				: id(_id), epoch(_epoch)
 			{
 			}
 
-			int    id;     /*!< Memory block ID */
-			size_t offset; /*!< Buffer offset   */
-			size_t size;   /*!< Block size      */
+			int      id;    /*!< Memory block ID           */
+			uint64_t epoch; /*!< Epoch it was retired at   */
 		};
 
 	public:
@@ -51,7 +102,8 @@ namespace SharedMemory
 		 */
 		MemoryManager()
 			: _addr(NULL), _in_use(), _is_init(false), _last_index(0),
-			  _size(0), _vacant()
+			  _pinned(0), _retired(), _ring(NULL), _size(0), _stats(),
+			  _trace(NULL), _used(0), _vacant()
 		{
 		}
 
@@ -63,8 +115,32 @@ namespace SharedMemory
 		}
 
 		/**
-		 * Allocate a block of memory. If \a size is zero, or if there
-		 * is no space left, -1 is returned
+		 * Move constructor. The lists are handed over, not copied,
+		 * and \a other is left uninitialized
+		 */
+		MemoryManager(MemoryManager&& other) : MemoryManager()
+		{
+			_swap(other);
+		}
+
+		/**
+		 * Move assignment, see the move constructor
+		 */
+		MemoryManager& operator=(MemoryManager&& other)
+		{
+			MemoryManager moved(std::move(other));
+			_swap(moved);
+
+			return *this;
+		}
+
+		MemoryManager(const MemoryManager&) = delete;
+		MemoryManager& operator=(const MemoryManager&) = delete;
+
+		/**
+		 * Allocate a block of memory. If \a size is zero or larger
+		 * than the pool, or if there is no space left, -1 is
+		 * returned
 		 *
 		 * @param[in] size The number of bytes to allocate
 		 *
@@ -74,10 +150,11 @@ namespace SharedMemory
 		int allocate(size_t size)
 		{
 			AbortIfNot( _is_init, -1);
-			AbortIf(size > _size, -1);
 
-			if (size == 0 || _vacant.empty())
-				return -1;
+			ProbeScope<probe_allocate> probe(size);
+
+			if (size == 0 || size > _size || _vacant.empty())
+				return probe.result(_failed(size));
 
 			/*
 			 * First pass: search through the list of vacancies for an
@@ -87,24 +164,29 @@ namespace SharedMemory
 				 iter != end; ++iter)
 			{
 				if (iter->size >= size)
-					return _allocate(iter, size);
+					return probe.result(_allocate(iter, size));
 			}
 
 			/*
 			 * Second attempt: We were unable to find a vacancy large
 			 * enough to accommodate the request, so go ahead and
 			 * defrag. This will consolidate all free elements into a
-			 * single blob which is hopefully big enough:
+			 * single blob which is hopefully big enough. Not while
+			 * any block is known by its address, though (see
+			 * allocate_ptr())
 			 */
+			if (_pinned > 0)
+				return probe.result(_failed(size));
+
 			defrag();
 
 			auto iter =  _vacant.begin();
 
 			if (iter->size >= size)
-				return
-					_allocate(iter,size);
+				return probe.result(
+					_allocate(iter,size));
 
-			return -1;
+			return probe.result(_failed(size));
 		}
 
 		/**
@@ -123,12 +205,153 @@ namespace SharedMemory
 			AbortIfNot(lookup(id, iter),
 					false);
 
-			_vacant.push_back( Block(-1, iter->offset, iter->size) );
+			if (iter->pinned)
+				_pinned--;
+
+			_vacate(iter->offset, iter->size);
+			_used -= iter->size;
 				_in_use.erase(iter);
 
+			_stats.frees++;
+
+			if (_ring)  _ring->record(trace_free, id);
+			if (_trace) _trace->record(TraceOp::free, id, 0);
+
+			return true;
+		}
+
+		/**
+		 * Allocate a block and return its address, for allocators
+		 * that deal in pointers (see MemoryResource.h). The pool is
+		 * never defragmented while such a block is allocated, since
+		 * that would move it
+		 *
+		 * @param[in] size  The number of bytes to allocate
+		 * @param[in] align The alignment needed, a power of 2
+		 *
+		 * @return The address of the block, or NULL if there is no
+		 *         space left
+		 */
+		void* allocate_ptr(size_t size,
+						   size_t align = alignof(std::max_align_t))
+		{
+			AbortIf(align == 0 || (align & (align-1)) != 0, NULL);
+			AbortIf(size > SIZE_MAX - (align-1), NULL);
+
+			/*
+			 * The pool's offsets have no alignment, so leave room
+			 * to move the start up to the next multiple
+			 */
+			_pinned++;
+
+			const int id = allocate(size + align - 1);
+			if (id < 0)
+			{
+				_pinned--;
+				return NULL;
+			}
+
+			/*
+			 * The block just allocated is the last one in use
+			 */
+			Block& block = _in_use.back();
+			block.pinned = true;
+
+			const uintptr_t addr = reinterpret_cast<uintptr_t>(_addr)
+				+ block.offset;
+
+			return reinterpret_cast<void*>(
+				(addr + align - 1) & ~uintptr_t(align - 1));
+		}
+
+		/**
+		 * Free a block returned by \ref allocate_ptr()
+		 *
+		 * @param[in] addr The address of the block
+		 *
+		 * @return True on success
+		 */
+		bool free_ptr(const void* addr)
+		{
+			AbortIfNot( _is_init, false );
+
+			const size_t offset = static_cast<const char*>(addr) -
+				static_cast<const char*>(_addr);
+
+			/*
+			 * The address may be past the start of the block, by up
+			 * to its alignment
+			 */
+			auto iter = _in_use.begin();
+			for (auto end = _in_use.end(); iter != end; ++iter)
+			{
+				if (iter->pinned && offset - iter->offset < iter->size)
+					break;
+			}
+
+			AbortIf(iter == _in_use.end(), false,
+				"%p was not allocated by allocate_ptr()\n", addr);
+
+			return free(iter->id);
+		}
+
+		/**
+		 * Free a block of memory once no reader can still be using
+		 * it. Use this instead of \ref free() for blocks that were
+		 * reachable from a lock-free structure, after unlinking them.
+		 * The block stays allocated until \ref reclaim() finds it
+		 * safe to release
+		 *
+		 * @param[in] id     The unique ID returned by \ref allocate()
+		 * @param[in] epochs The epochs of the segment's readers
+		 *
+		 * @return True on success
+		 */
+		bool retire(int id, const EpochTable& epochs)
+		{
+			AbortIfNot( _is_init, false );
+
+			std::list<Block>::const_iterator iter;
+			AbortIfNot(lookup(id, iter),
+					false);
+
+			_retired.push_back(Retired(id, epochs.current()));
 			return true;
 		}
 
+		/**
+		 * Free all retired blocks that no reader can be using
+		 * anymore. Call this periodically from the process that
+		 * retired them
+		 *
+		 * @param[in] epochs The epochs of the segment's readers
+		 *
+		 * @return The number of blocks freed
+		 */
+		size_t reclaim(EpochTable& epochs)
+		{
+			if (_retired.empty())
+				return 0;
+
+			epochs.advance();
+			const uint64_t safe = epochs.safe_epoch();
+
+			size_t freed = 0;
+			for (auto iter = _retired.begin(); iter != _retired.end();)
+			{
+				if (iter->epoch < safe)
+				{
+					free(iter->id);
+					iter = _retired.erase(iter);
+					freed++;
+				}
+				else
+					++iter;
+			}
+
+			return freed;
+		}
+
 		/**
 		 * Initialize
 		 *
@@ -152,6 +375,90 @@ namespace SharedMemory
 			return true;
 		}
 
+		/**
+		 * Get the total number of bytes not allocated
+		 *
+		 * @return The free space, in bytes
+		 */
+		size_t free_bytes() const
+		{
+			return _size - _used;
+		}
+
+		/**
+		 * Get the size of the largest contiguous free region, i.e.
+		 * the largest block that can be allocated without a defrag
+		 *
+		 * @return The size, in bytes
+		 */
+		size_t largest_free() const
+		{
+			size_t largest = 0;
+			for (auto iter = _vacant.begin(), end = _vacant.end();
+				 iter != end; ++iter)
+			{
+				if (iter->size > largest) largest = iter->size;
+			}
+
+			return largest;
+		}
+
+		/**
+		 * Get the allocator's counters, along with its current
+		 * occupancy and fragmentation. The counters are maintained
+		 * as the pool is used; only \a largest_free (and therefore
+		 * \a fragmentation) requires walking the free list
+		 *
+		 * @return The statistics
+		 */
+		AllocatorStats stats() const
+		{
+			AllocatorStats stats = _stats;
+
+			stats.live_blocks  = _in_use.size();
+			stats.free_bytes   = free_bytes();
+			stats.largest_free = largest_free();
+
+			stats.fragmentation = stats.free_bytes == 0 ? 0.0 :
+				1.0 - double(stats.largest_free) / stats.free_bytes;
+
+			return stats;
+		}
+
+		/**
+		 * Zero the counters reported by \ref stats(). Occupancy is
+		 * unaffected
+		 */
+		void reset_stats()
+		{
+			_stats = AllocatorStats();
+		}
+
+		/**
+		 * Start or stop recording every allocate, free and defrag
+		 * into a trace, e.g. to replay a production workload later
+		 *
+		 * @param[in] trace The trace to append to, or NULL to stop
+		 *                  recording. It must outlive this object or
+		 *                  be detached first
+		 */
+		void set_trace(MemoryTrace* trace)
+		{
+			_trace = trace;
+			if (_trace) _trace->set_pool(_size);
+		}
+
+		/**
+		 * Log allocations, frees and defrags to a segment's trace
+		 * ring, whenever the ring is enabled
+		 *
+		 * @param[in] ring The ring, or NULL to stop
+		 */
+		void set_trace_ring(TraceRing* ring)
+		{
+			_ring = ring;
+		}
+
 		/**
 		 * Read the contents of an allocated memory block
 		 * 
@@ -241,10 +548,67 @@ namespace SharedMemory
 					iter->offset += size;
 			}
 
+			_used += size;
+			_stats.allocations++;
+
+			if (_ring) _ring->record(trace_allocate, size);
+
+			if (_trace)
+				_trace->record(TraceOp::allocate, _last_index, size);
+
 			return
 				_last_index++;
 		}
 
+		/*
+		 * Return a region to the free list, merged with the free
+		 * regions on either side of it, so that freed space can be
+		 * reused in one piece without moving anything
+		 */
+		void _vacate(size_t offset, size_t size)
+		{
+			auto merged = _vacant.end();
+
+			for (auto iter = _vacant.begin(); iter != _vacant.end();)
+			{
+				if (iter->offset + iter->size == offset)
+				{
+					offset = iter->offset;
+					size  += iter->size;
+				}
+				else if (offset + size == iter->offset)
+					size  += iter->size;
+				else
+				{
+					++iter;
+					continue;
+				}
+
+				if (merged != _vacant.end())
+					_vacant.erase(merged);
+
+				merged = iter++;
+			}
+
+			if (merged == _vacant.end())
+				_vacant.push_back(Block(-1, offset, size));
+			else
+			{
+				merged->offset = offset;
+				merged->size   = size;
+			}
+		}
+
+		/*
+		 * Report an allocation request we couldn't satisfy
+		 */
+		int _failed(size_t size)
+		{
+			_stats.failed++;
+			if (_trace) _trace->record(TraceOp::allocate, -1, size);
+			return -1;
+		}
+
 		/**
 		 * Defragment the memory pool. This is called whenever there
 		 * is space left, but the unused blocks are scattered
@@ -252,11 +616,30 @@ namespace SharedMemory
 		 * into one big chunk of free memory, and all used blocks
 		 * are also placed contiguously. The goal is to service
 		 * an allocation request that needs a larger block than what
-		 * can be obtained from the scattered pieces
+		 * can be obtained from the scattered pieces. Nothing is moved
+		 * while any block from \ref allocate_ptr() is allocated
 		 */
 		void defrag()
 		{
-			size_t offset = 0;
+			if (_pinned > 0)
+				return;
+
+			ProbeScope<probe_defrag> probe(_size - _used);
+
+			struct timespec start, end;
+			::clock_gettime(CLOCK_MONOTONIC, &start);
+
+			/*
+			 * Blocks are slid down in address order, so that none
+			 * is overwritten before it has been moved itself
+			 */
+			_in_use.sort(
+				[](const Block& a, const Block& b)
+				{
+					return a.offset < b.offset;
+				});
+
+			size_t offset = 0, moved = 0;
 			for (auto iter = _in_use.begin(), end = _in_use.end();
 				 iter != end; ++iter)
 			{
@@ -264,7 +647,10 @@ namespace SharedMemory
 				void* addr =  addr_c + iter->offset;
 
 				if (offset != iter->offset)
-					std::memcpy(addr_c+ offset, addr, iter->size);
+				{
+					std::memmove(addr_c+ offset, addr, iter->size);
+					moved += iter->size;
+				}
 
 				iter->offset = offset;
 				offset += iter->size;
@@ -273,6 +659,19 @@ namespace SharedMemory
 			_vacant.clear();
 			_vacant.push_back(Block(-1, offset,
 						_size-offset));
+
+			::clock_gettime(CLOCK_MONOTONIC, &end);
+
+			_stats.defrags++;
+			_stats.bytes_compacted += moved;
+			_stats.compaction_ns +=
+				(end.tv_sec - start.tv_sec) * 1000000000LL +
+				(end.tv_nsec - start.tv_nsec);
+
+			probe.result(moved);
+
+			if (_ring)  _ring->record(trace_defrag, moved);
+			if (_trace) _trace->record(TraceOp::defrag, -1, moved);
 		}
 
 		/**
@@ -299,12 +698,38 @@ namespace SharedMemory
 			return false;
 		}
 
+		void _swap(MemoryManager& other)
+		{
+			std::swap(_addr,       other._addr);
+			std::swap(_in_use,     other._in_use);
+			std::swap(_is_init,    other._is_init);
+			std::swap(_last_index, other._last_index);
+			std::swap(_pinned,     other._pinned);
+			std::swap(_retired,    other._retired);
+			std::swap(_ring,       other._ring);
+			std::swap(_size,       other._size);
+			std::swap(_stats,      other._stats);
+			std::swap(_trace,      other._trace);
+			std::swap(_used,       other._used);
+			std::swap(_vacant,     other._vacant);
+		}
+
 		void*  _addr;
 		std::list<Block>
 			   _in_use;
 		bool   _is_init;
 		int    _last_index;
+		size_t _pinned;
+		std::list<Retired>
+			   _retired;
+		TraceRing*
+			   _ring;
 		size_t _size;
+		AllocatorStats
+			   _stats;
+		MemoryTrace*
+			   _trace;
+		size_t _used;
 		std::list<Block>
 			   _vacant;
 	};
@@ -321,6 +746,169 @@ namespace SharedMemory
 
 	} access_t;
 
+	/**
+	 * Fault in and lock every page of a mapping, so that the first
+	 * access to each page doesn't stall on a page fault
+	 *
+	 * @param[in] addr     The start of the mapping
+	 * @param[in] size     The size of the mapping, in bytes
+	 * @param[in] writable True if the mapping is writable, in which
+	 *                     case pages are faulted in for writing
+	 *
+	 * @return True on success
+	 */
+	inline bool prefault(void* addr, size_t size, bool writable)
+	{
+#ifdef MADV_POPULATE_WRITE
+		/*
+		 * mlock() only read-faults shared mappings, so the first
+		 * write to each page would still fault
+		 */
+		if (writable)
+			::madvise(addr, size, MADV_POPULATE_WRITE);
+#else
+		(void)writable;
+#endif
+		AbortIf(::mlock(addr, size) == -1,
+			false);
+
+		return true;
+	}
+
+	/**
+	 * Open a shared object created by a \ref RemoteMemory. Read-only
+	 * clients open it for writing too when its permissions allow, so
+	 * that they can write to its header (see \ref map_segment())
+	 *
+	 * @param[in] name   The object's name, with its leading '/'
+	 * @param[in] access The client's permissions
+	 *
+	 * @return The file descriptor, or -1 on error
+	 */
+	inline int open_segment(const std::string& name, access_t access)
+	{
+		int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+
+		if (fd == -1 && errno == EACCES && access == read_only)
+			fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+
+		return fd;
+	}
+
+	/**
+	 * Check whether a shared object was opened for writing, which
+	 * is what lets a client write to its header
+	 *
+	 * @param[in] fd The file descriptor
+	 *
+	 * @return True if so
+	 */
+	inline bool opened_for_writing(int fd)
+	{
+		return (::fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDWR;
+	}
+
+	/**
+	 * Map a shared object from \ref open_segment() and check its
+	 * header. The user data is only writable with read-write access,
+	 * but the header is writable whenever the object was opened for
+	 * writing, so that read-only clients can join the peer registry,
+	 * count their reads and grant flow control credits
+	 *
+	 * @param[in]  fd     The file descriptor
+	 * @param[in]  access The client's permissions
+	 * @param[in]  size   Number of bytes of user data to map
+	 * @param[in]  flags  mmap() flags besides MAP_SHARED, e.g.
+	 *                    MAP_POPULATE
+	 * @param[out] header The header, at the start of the mapping
+	 *
+	 * @return True on success
+	 */
+	inline bool map_segment(int fd, access_t access, size_t size,
+							int flags, SegmentHeader*& header)
+	{
+		const size_t map_size = data_offset() + size;
+
+		const int prot = access == read_write ?
+			PROT_READ | PROT_WRITE : PROT_READ;
+
+		void* addr = ::mmap(NULL, map_size, prot, MAP_SHARED | flags,
+							fd, 0);
+		AbortIf(addr == MAP_FAILED, false);
+
+		header = static_cast<SegmentHeader*>(addr);
+
+		const bool ok = header->valid(size) &&
+			(access == read_write || !opened_for_writing(fd) ||
+			 ::mprotect(addr, data_offset(),
+						PROT_READ | PROT_WRITE) == 0);
+
+		if (!ok)
+		{
+			::munmap(addr, map_size);
+			AbortIf(true, false);
+		}
+
+		return true;
+	}
+
+	/**
+	 * Copy a message into a segment and publish it: the body of
+	 * every writer's write(). This first takes a flow control credit
+	 * (see \ref SegmentHeader::begin_write()). With synchronous
+	 * writes, it also locks the mapping into physical memory during
+	 * the copy, then flushes it to the file system
+	 *
+	 * @param[in] header The header, at the start of the mapping
+	 * @param[in] size   Number of bytes of user data
+	 * @param[in] buf    The message
+	 * @param[in] bytes  Its size
+	 * @param[in] flow   The writer's flow control policy
+	 * @param[in] slot   The writer's peer slot
+	 * @param[in] sync   True to lock and flush the mapping
+	 * @param[in] stamp  True to stamp the message with the TSC
+	 *
+	 * @return True on success
+	 */
+	inline bool write_segment(SegmentHeader* header, size_t size,
+							  const void* buf, size_t bytes, flow_t flow,
+							  int slot, bool sync, bool stamp)
+	{
+		AbortIf(bytes > size, false);
+
+		uint64_t waited;
+		bool dropped;
+
+		if (!header->begin_write(flow, bytes, waited, dropped))
+			return false;
+
+		char* addr = reinterpret_cast<char*>(header);
+		const size_t map_size = data_offset() + size;
+
+		if (!sync)
+			std::memcpy(addr + data_offset(), buf, bytes);
+		else
+		{
+			AbortIf(::mlock(addr, map_size) == -1,
+				false);
+
+			std::memcpy(addr + data_offset(), buf, bytes);
+
+			AbortIf(::munlock(addr, map_size) == -1,
+				false);
+
+			/*
+			 * Note that this commits the entire file
+			 */
+			AbortIf(::msync(addr, map_size,
+						MS_SYNC | MS_INVALIDATE) == -1,
+				false);
+		}
+
+		header->end_write(slot, bytes, waited, dropped, stamp);
+		return true;
+	}
+
 
 	/**
 	 ******************************************************************
@@ -328,7 +916,9 @@ namespace SharedMemory
 	 * @class RemoteMemory
 	 *
 	 * Creates a shared memory object which client processes may read
-	 * from/write to
+	 * from/write to. The object starts with a \ref SegmentHeader
+	 * holding a process-shared lock which writers can use to
+	 * coordinate with each other
 	 *
 	 ******************************************************************
 	 */
@@ -344,11 +934,16 @@ namespace SharedMemory
 			: _access( none ),
 			  _addr(NULL),
 			  _fd(-1),
+			  _flow(flow_off),
+			  _header(NULL),
 			  _is_init(false),
 			  _manager(),
 			  _mem_id(-1),
 			  _name(""),
-			  _size(0)
+			  _peer_slot(-1),
+			  _size(0),
+			  _sync_writes(true),
+			  _timestamps(false)
 		{
 		}
 
@@ -360,6 +955,30 @@ namespace SharedMemory
 			if (_is_init) destroy();
 		}
 
+		/**
+		 * Move constructor. \a other gives up the shared object, and
+		 * only this one will destroy it
+		 */
+		RemoteMemory(RemoteMemory&& other) : RemoteMemory()
+		{
+			_swap(other);
+		}
+
+		/**
+		 * Move assignment. The object this held, if any, is
+		 * destroyed
+		 */
+		RemoteMemory& operator=(RemoteMemory&& other)
+		{
+			RemoteMemory moved(std::move(other));
+			_swap(moved);
+
+			return *this;
+		}
+
+		RemoteMemory(const RemoteMemory&) = delete;
+		RemoteMemory& operator=(const RemoteMemory&) = delete;
+
 		/**
 		 * Create the shared object
 		 *
@@ -370,11 +989,13 @@ namespace SharedMemory
 		 * @param[in] access Permissions to give to processes using
 		 *                   this resource
 		 * @param[in] size   The total number of bytes to be shared
+		 * @param[in] layout The hash of the data's \ref StaticLayout,
+		 *                   for clients to check, or 0 if untyped
 		 *
 		 * @return True on success
 		 */
 		bool create(const std::string& name, access_t access,
-					size_t size)
+					size_t size, uint64_t layout = 0)
 		{
 			AbortIfNot(init(access, name, size),
 				false);
@@ -401,15 +1022,23 @@ namespace SharedMemory
 			AbortIf(fd == -1, false);
 			_fd = fd;
 
-			AbortIf(::ftruncate(_fd, _size) == -1,
+			AbortIf(::ftruncate(_fd, _map_size()) == -1,
 				false);
 
-			_addr = ::mmap(NULL, _size, prot, MAP_SHARED, _fd, 0);
-			AbortIf(errno, false);
+			_addr = ::mmap(NULL, _map_size(), prot, MAP_SHARED, _fd,
+						   0);
+			AbortIf(_addr == MAP_FAILED, false);
+
+			_header = new (_addr) SegmentHeader();
+			_header->init(_size, layout);
 
-			AbortIfNot(_manager.init(_addr, _size),
+			_peer_slot = _header->peers.join();
+
+			AbortIfNot(_manager.init(_data(), _size),
 				false);
 
+			_manager.set_trace_ring(&_header->ring);
+
 			_mem_id =  _manager.allocate ( _size );
 			AbortIf(_mem_id == -1,
 				false);
@@ -428,7 +1057,10 @@ namespace SharedMemory
 		{
 			AbortIfNot(_is_init, false);
 
-			AbortIf(::munmap    (_addr, _size)  == -1,
+			_header->peers.leave(_peer_slot);
+			_peer_slot = -1;
+
+			AbortIf(::munmap(_addr, _map_size()) == -1,
 				 false);
 			AbortIf(::shm_unlink(_name.c_str()) == -1,
 				false);
@@ -452,10 +1084,16 @@ namespace SharedMemory
 		bool read( void* buf, size_t size ) const
 		{
 			AbortIfNot(_is_init, false);
+
+			ProbeScope<probe_read> probe(size);
+
+			const uint64_t seq = _header->stats.sequence();
+
 			AbortIfNot(_manager.read( _mem_id, buf, size ),
 				false);
 
-			return true;
+			_header->stats.read(_peer_slot, size, seq);
+			return probe.result(true);
 		}
 
 		/**
@@ -471,33 +1109,314 @@ namespace SharedMemory
 		{
 			AbortIfNot( _is_init, false );
 
-			/*
-			 * Lock this resource into physical memory while making
-			 * changes
-			 */
-			AbortIf(::mlock( _addr, _size ) == -1,
-				false);
-
-			AbortIfNot(
-				_manager.write(_mem_id, buf,size),
-				false);
+			ProbeScope<probe_write> probe(size);
 
-			AbortIf(::munlock(_addr, _size) == -1,
-				false);
+			return probe.result(write_segment(_header, _size, buf, size,
+				_flow, _peer_slot, _sync_writes, _timestamps));
+		}
 
-			/*
-			 * Flush changes back to the file system. Note that this
-			 * commits the entire file
-			 */
-			AbortIf(::msync(_addr, _size,
-						MS_SYNC | MS_INVALIDATE) == -1,
+		/**
+		 * Acquire the segment lock for writing. If a process died
+		 * while holding it, the lock is taken back and the segment
+		 * is flagged (see \ref needs_validation())
+		 *
+		 * @return True on success
+		 */
+		bool lock()
+		{
+			AbortIfNot(_is_init, false);
+			AbortIfNot(_header->lock(_peer_slot),
+				false);
+
+			return true;
+		}
+
+		/**
+		 * Release the segment lock held for writing
+		 *
+		 * @return True on success
+		 */
+		bool unlock()
+		{
+			AbortIfNot(_is_init, false);
+			_header->rwlock.unlock();
+
+			return true;
+		}
+
+		/**
+		 * Acquire the segment lock for reading
+		 *
+		 * @return True on success
+		 */
+		bool lock_shared()
+		{
+			AbortIfNot(_is_init, false);
+			AbortIfNot(_header->lock_shared(_peer_slot),
+				false);
+
+			return true;
+		}
+
+		/**
+		 * Release the segment lock held for reading
+		 *
+		 * @return True on success
+		 */
+		bool unlock_shared()
+		{
+			AbortIfNot(_is_init, false);
+			_header->rwlock.unlock_shared();
+
+			return true;
+		}
+
+		/**
+		 * Acquire the segment's priority-inheritance mutex. Use this
+		 * instead of \ref lock() when real-time threads contend with
+		 * lower-priority ones. Both locks guard the same data, so a
+		 * program should pick one of them
+		 *
+		 * @return True on success
+		 */
+		bool lock_pi()
+		{
+			AbortIfNot(_is_init, false);
+			AbortIfNot(_header->lock_pi(_peer_slot),
+				false);
+
+			return true;
+		}
+
+		/**
+		 * Release the segment's priority-inheritance mutex
+		 *
+		 * @return True on success
+		 */
+		bool unlock_pi()
+		{
+			AbortIfNot(_is_init, false);
+			_header->pi_mutex.unlock();
+
+			return true;
+		}
+
+		/**
+		 * Check whether a writer died while holding the segment
+		 * lock, in which case the data may be half-written
+		 *
+		 * @return True if the data should be validated
+		 */
+		bool needs_validation() const
+		{
+			return _is_init && (_header->flags.load() &
+				SegmentHeader::needs_validation);
+		}
+
+		/**
+		 * Clear the flag raised by a lock recovery, once the data
+		 * has been checked or repaired
+		 *
+		 * @return True on success
+		 */
+		bool validated()
+		{
+			AbortIfNot(_is_init, false);
+			_header->flags.fetch_and(~SegmentHeader::needs_validation);
+
+			return true;
+		}
+
+		/**
+		 * Get the epoch table kept in the segment header, used to
+		 * defer freeing memory until no reader can still see it (see
+		 * \ref MemoryManager::retire())
+		 *
+		 * @return The epoch table, or NULL if not initialized
+		 */
+		EpochTable* epochs()
+		{
+			return _is_init ? &_header->epochs : NULL;
+		}
+
+		/**
+		 * Get the registry of processes attached to the segment,
+		 * which can be used to list them or to free the slots of
+		 * those that exited without detaching
+		 *
+		 * @return The registry, or NULL if not initialized
+		 */
+		PeerRegistry* peers()
+		{
+			return _is_init ? &_header->peers : NULL;
+		}
+
+		/**
+		 * Make \ref write() spend a credit granted by the consumer,
+		 * and choose what happens when there are none left
+		 *
+		 * @param[in] policy The flow control policy. With \ref
+		 *                   flow_off (the default) writes always
+		 *                   proceed
+		 *
+		 * @return True on success
+		 */
+		bool set_flow_control(flow_t policy)
+		{
+			AbortIfNot(_is_init, false);
+
+			_flow = policy;
+			return true;
+		}
+
+		/**
+		 * Fault in and lock every page of the segment, so that no
+		 * read or write stalls on a page fault
+		 *
+		 * @return True on success
+		 */
+		bool prefault()
+		{
+			AbortIfNot(_is_init, false);
+			AbortIfNot(SharedMemory::prefault(_addr, _map_size(), true),
 				false);
 
 			return true;
 		}
 
+		/**
+		 * Choose whether \ref write() locks the segment into memory
+		 * and msync()s it on every call. That costs three system
+		 * calls per write and isn't needed to make writes visible to
+		 * other processes, so low-latency users turn it off
+		 *
+		 * @param[in] sync True to sync on every write (the default)
+		 *
+		 * @return True on success
+		 */
+		bool set_sync_writes(bool sync)
+		{
+			AbortIfNot(_is_init, false);
+
+			_sync_writes = sync;
+			return true;
+		}
+
+		/**
+		 * Get the address of the shared data, for direct access.
+		 * Unlike \ref read() and \ref write(), access through it
+		 * takes no lock and isn't counted in the segment's stats
+		 *
+		 * @return The address, or NULL if not created
+		 */
+		void* data() const
+		{
+			return _is_init ? _data() : NULL;
+		}
+
+		/**
+		 * Choose whether \ref write() stamps each message with the
+		 * TSC, so that clients can measure publish-to-read latency
+		 * (see \ref MemoryClient::latency())
+		 *
+		 * @param[in] enabled True to stamp writes (default false)
+		 *
+		 * @return True on success
+		 */
+		bool set_timestamps(bool enabled)
+		{
+			AbortIfNot(_is_init, false);
+
+			_timestamps = enabled;
+			return true;
+		}
+
+		/**
+		 * Turn the segment's trace ring on or off. This applies to
+		 * every process using the segment. Dump the ring with
+		 * shmtrace
+		 *
+		 * @param[in] enabled True to record events
+		 *
+		 * @return True on success
+		 */
+		bool set_tracing(bool enabled)
+		{
+			AbortIfNot(_is_init, false);
+
+			_header->ring.enable(enabled);
+			return true;
+		}
+
+		/**
+		 * Get the segment's flow control counters, e.g. the time
+		 * producers spent waiting for credits
+		 *
+		 * @param[out] stats The counters
+		 *
+		 * @return True on success
+		 */
+		bool flow_stats(FlowStats& stats) const
+		{
+			AbortIfNot(_is_init, false);
+
+			stats = _header->flow.stats();
+			return true;
+		}
+
+		/**
+		 * Signal to attached clients that this process is alive and
+		 * making progress
+		 *
+		 * @param[in] cursor Our current position, e.g. the sequence
+		 *                   number of the last write
+		 *
+		 * @return True on success
+		 */
+		bool heartbeat(uint64_t cursor)
+		{
+			AbortIfNot(_is_init, false);
+			AbortIf(_peer_slot < 0, false);
+
+			_header->peers.heartbeat(_peer_slot, cursor);
+			return true;
+		}
+
 	private:
 
+		/*
+		 * The start of the user's data, just past the header
+		 */
+		void* _data() const
+		{
+			return static_cast<char*>(_addr) + data_offset();
+		}
+
+		/*
+		 * The total number of bytes mapped, header included
+		 */
+		size_t _map_size() const
+		{
+			return data_offset() + _size;
+		}
+
+		void _swap(RemoteMemory& other)
+		{
+			std::swap(_access,      other._access);
+			std::swap(_addr,        other._addr);
+			std::swap(_fd,          other._fd);
+			std::swap(_flow,        other._flow);
+			std::swap(_header,      other._header);
+			std::swap(_is_init,     other._is_init);
+			std::swap(_manager,     other._manager);
+			std::swap(_mem_id,      other._mem_id);
+			std::swap(_name,        other._name);
+			std::swap(_peer_slot,   other._peer_slot);
+			std::swap(_size,        other._size);
+			std::swap(_sync_writes, other._sync_writes);
+			std::swap(_timestamps,  other._timestamps);
+		}
+
 		/*
 		 * Assign defaults to members
 		 */
@@ -528,11 +1447,17 @@ namespace SharedMemory
 		access_t      _access;
 		void*         _addr;
 		int           _fd;
+		flow_t        _flow;
+		SegmentHeader*
+			      _header;
 		bool          _is_init;
 		MemoryManager _manager;
 		int           _mem_id;
 		std::string   _name;
+		int           _peer_slot;
 		size_t        _size;
+		bool          _sync_writes;
+		bool          _timestamps;
 
 	};
 
@@ -543,49 +1468,101 @@ namespace SharedMemory
 	 * @class MemoryClient
 	 *
 	 * Opens up and maps one or more shared memory objects for reading
-	 * and/or writing
+	 * and/or writing. Clients with read-write access may also take
+	 * the lock kept in each object's \ref SegmentHeader
 	 *
 	 ******************************************************************
 	 */
 	class MemoryClient
 	{
+		/*
+		 * The parts of an attached object that reads and writes
+		 * don't touch
+		 */
+		struct Mapping
+		{
+			Mapping(int _fd, const std::string& _name)
+				: fd(_fd), latency(), mapped(), name(_name)
+			{
+			}
+
+			int fd;
+			LatencyHistogram
+					latency;
+			std::once_flag
+					mapped;
+			std::string name;
+		};
+
+		/*
+		 * An entry in the handle table. Everything that reads and
+		 * writes need fits in one cache line, and the rest is kept
+		 * in the Mapping. The generation and peer slot are narrowed
+		 * to make room. A free entry has no Mapping
+		 */
 		struct Server
 		{
-			Server(access_t _access, void* _addr, int _fd, int _id,
-				   const std::string& _name, size_t _size)
-				: access( _access ),
-				  addr( _addr),
-				  fd(_fd),
-				  id(_id),
-				  mem_id( -1 ),
-				  name(_name),
-				  	size(_size)
+			Server()
+				: header(NULL),
+				  data(NULL),
+				  size(0),
+				  last_seq(0),
+				  mapping(),
+				  latency(NULL),
+				  access(none),
+				  flow(flow_off),
+				  generation(0),
+				  peer_slot(-1),
+				  control(false),
+				  lazy(false),
+				  sync_writes(true),
+				  timestamps(false)
 			{
 			}
 
-			bool init()
+			size_t map_size() const
 			{
-				AbortIfNot( manager.init(addr,size), false );
-				return true;
+				return data_offset() + size;
 			}
 
-			access_t access;
-			void* addr;
-			int fd;
-			int id;
-			MemoryManager
-					manager;
-			int mem_id;
-			std::string name;
+			SegmentHeader* header;
+			char* data;
 			size_t size;
+			mutable uint64_t
+					last_seq;
+			std::unique_ptr<Mapping>
+					mapping;
+			LatencyHistogram*
+					latency;
+			access_t access;
+			flow_t flow;
+			uint16_t generation;
+			int16_t peer_slot;
+			bool control;
+			bool lazy;
+			bool sync_writes;
+			bool timestamps;
 		};
 
+		static_assert(sizeof(Server) <= 64,
+			"A handle table entry must fit in a cache line");
+
+		/*
+		 * IDs are an index into the handle table in the low bits,
+		 * and the entry's generation above them, so that the ID of
+		 * a destroyed object doesn't refer to whatever reuses its
+		 * entry
+		 */
+		static const int      index_bits      = 20;
+		static const uint32_t index_mask      = (1u << index_bits) - 1;
+		static const uint32_t max_generations = 1u << (31 - index_bits);
+
 	public:
 
 		/**
 		 * Constructor
 		 */
-		MemoryClient() : _last_id(0), _servers()
+		MemoryClient() : _free(), _names(), _servers()
 		{
 		}
 
@@ -594,12 +1571,38 @@ namespace SharedMemory
 		 */
 		~MemoryClient()
 		{
-			for (size_t i = _servers.size(); i > 0; i--)
+			for (size_t i = 0; i < _servers.size(); i++)
 			{
-				destroy((_servers.begin())->id);
+				if (_servers[i].mapping)
+					destroy(_id(i, _servers[i].generation));
 			}
 		}
 
+		/**
+		 * Move constructor. The handle table is handed over, so IDs
+		 * from \a other are valid here, and \a other is left with
+		 * nothing attached
+		 */
+		MemoryClient(MemoryClient&& other) : MemoryClient()
+		{
+			_swap(other);
+		}
+
+		/**
+		 * Move assignment. Objects this was attached to are
+		 * destroyed
+		 */
+		MemoryClient& operator=(MemoryClient&& other)
+		{
+			MemoryClient moved(std::move(other));
+			_swap(moved);
+
+			return *this;
+		}
+
+		MemoryClient(const MemoryClient&) = delete;
+		MemoryClient& operator=(const MemoryClient&) = delete;
+
 		/**
 		 * Attach to a shared memory object
 		 *
@@ -609,100 +1612,184 @@ namespace SharedMemory
 		 * @param[in]  size   Number of bytes to use
 		 * @param[out] id     The unique id to reference the shared
 		 *                    object by
+		 * @param[in]  lazy   If true, only open the object now, and
+		 *                    map it the first time the ID is used.
+		 *                    A bad header is then only reported at
+		 *                    that point, and the ID stays unusable.
+		 *                    Threads may race to use it first
 		 *
 		 * @return True on success
 		 */
 		bool attach(const std::string& name, access_t access,
-					 size_t size, int& id)
+					 size_t size, int& id, bool lazy = false)
 		{
-			int oflag = 0, prot;
-
-			switch (access)
-			{
-			case read_only:
-				oflag =  O_RDONLY;
-				prot  = PROT_READ;
-				break;
-			case read_write:
-				oflag = O_RDWR;
-				prot  =
-					PROT_READ | PROT_WRITE;
-				break;
-			default:
-				prot  = PROT_NONE;
-			}
-
 			AbortIf(name.size() == 0,
 				false);
 
+			const std::string real_name = _real_name(name);
+
 			/*
 			 * Make sure we are not trying to re-attach to the same
 			 * shared object
 			 */
-			std::string real_name;
-			if (name[0] != '/')
-				real_name = std::string("/") + name;
-			else
-				real_name = name;
-
-			for (auto iter =_servers.begin(), end = _servers.end();
-				 iter != end; ++iter)
-			{
-				AbortIf(iter->name == real_name,
-					false);
-			}
-
-			int fd = ::shm_open(real_name.c_str(), oflag, 0);
-			AbortIf(fd == -1, false);
-
-			void* addr =
-				 ::mmap(NULL, size, prot, MAP_SHARED, fd, 0);
-			AbortIf(errno, false);
-
-			Server&& server =
-				Server(access, addr, fd, _last_id, real_name,
-						size);
-
-			/*
-			 * Initialize the manager for this resource. No further
-			 * memory allocations or deletions are performed
-			 * since that could potentially misalign our memory and
-			 * the RemoteMemory's copy
-			 */
-			AbortIfNot ( server.init(),
+			AbortIf(_names.count(real_name),
 				false);
 
-			server.mem_id = server.manager.allocate( size );
-			AbortIf(server.mem_id < 0,
-				false);
+			int fd; SegmentHeader* header;
+			AbortIfNot(_open(real_name, access, size, lazy, fd,
+				header), false);
 
-			_servers.push_back(server);
+			AbortIfNot(_insert(real_name, access, size, fd, header, id),
+				false);
 
-			id = _last_id++;
 			return true;
 		}
 
 		/**
-		 * Remove a shared object, unmap it from memory, and close
-		 * the file descriptor
+		 * One shared object to attach to with \ref attach_all()
+		 */
+		struct Attachment
+		{
+			std::string name;   /*!< The name of the shared object  */
+			access_t    access; /*!< Permissions for this process   */
+			size_t      size;   /*!< Number of bytes to use         */
+			int         id;     /*!< The ID assigned, or -1         */
+		};
+
+		/**
+		 * Attach to many shared objects at once. Opening and mapping
+		 * them, which is nearly all of the cost, is spread over a
+		 * pool of threads, and the objects are then entered in the
+		 * table in order. An object that can't be attached gets an
+		 * ID of -1 and doesn't stop the others
 		 *
-		 * @param [in] id A unique ID returned by /ref attach() by
-		 *                which to reference the object
+		 * @param[in,out] batch   The objects to attach to. Each one's
+		 *                        \ref Attachment::id is set
+		 * @param[in]     lazy    See \ref attach()
+		 * @param[in]     threads The number of threads to use, or 0
+		 *                        for one per CPU
 		 *
-		 * @return True on success
+		 * @return True if every object was attached
 		 */
-		bool destroy(int id)
+		bool attach_all(std::vector<Attachment>& batch, bool lazy = false,
+						size_t threads = 0)
 		{
-			std::list<Server>::const_iterator iter;
-			AbortIfNot(lookup(id, iter),
-				false);
+			struct Opened
+			{
+				int fd;
+				SegmentHeader* header;
+				bool ok;
+			};
+
+			std::vector<Opened> opened(batch.size());
+			std::vector<std::string> names(batch.size());
+
+			for (size_t i = 0; i < batch.size(); i++)
+			{
+				batch[i].id  = -1;
+				opened[i].ok = false;
+
+				if (!batch[i].name.empty())
+					names[i] = _real_name(batch[i].name);
+			}
+
+			std::atomic<size_t> next(0);
+
+			auto work = [&]()
+			{
+				for (size_t i; (i = next++) < batch.size(); )
+				{
+					if (names[i].empty() || _names.count(names[i]))
+						continue;
+
+					opened[i].ok = _open(names[i], batch[i].access,
+						batch[i].size, lazy, opened[i].fd,
+						opened[i].header);
+				}
+			};
+
+			if (threads == 0)
+				threads = std::thread::hardware_concurrency();
+
+			threads = std::min(threads, batch.size());
 
-			AbortIf(::munmap (iter->addr,iter->size) == -1,
+			/*
+			 * The calling thread is one of the pool
+			 */
+			std::vector<std::thread> pool;
+			for (size_t i = 1; i < threads; i++)
+				pool.emplace_back(work);
+
+			work();
+
+			for (size_t i = 0; i < pool.size(); i++)
+				pool[i].join();
+
+			bool ok = true;
+			for (size_t i = 0; i < batch.size(); i++)
+			{
+				if (!opened[i].ok)
+				{
+					ok = false;
+					continue;
+				}
+
+				/*
+				 * The same name might appear twice in the batch
+				 */
+				if (_names.count(names[i]) ||
+					!_insert(names[i], batch[i].access, batch[i].size,
+						opened[i].fd, opened[i].header, batch[i].id))
+				{
+					if (opened[i].header)
+						::munmap(opened[i].header,
+								 data_offset() + batch[i].size);
+					::close(opened[i].fd);
+
+					ok = false;
+				}
+			}
+
+			return ok;
+		}
+
+		/**
+		 * Remove a shared object, unmap it from memory, and close
+		 * the file descriptor
+		 *
+		 * @param [in] id A unique ID returned by /ref attach() by
+		 *                which to reference the object
+		 *
+		 * @return True on success
+		 */
+		bool destroy(int id)
+		{
+			Server* server = _find(id);
+			AbortIfNot(server,
 				false);
-			AbortIf(::close(iter->fd) == -1 ,
+
+			if (server->header)
+			{
+				if (server->peer_slot >= 0)
+					server->header->peers.leave(server->peer_slot);
+
+				AbortIf(::munmap(server->header, server->map_size())
+					== -1, false);
+			}
+
+			AbortIf(::close(server->mapping->fd) == -1 ,
 				false);
 
-			_servers.erase(iter);
+			_names.erase(server->mapping->name);
+			server->mapping.reset();
+			server->header  = NULL;
+			server->data    = NULL;
+			server->latency = NULL;
+
+			server->generation = static_cast<uint16_t>(
+				(server->generation + 1) % max_generations);
+			_free.push_back(id & index_mask);
+
 			return true;
 		}
 
@@ -718,13 +1805,28 @@ namespace SharedMemory
 		 */
 		bool read( int id, void* buf, size_t size ) const
 		{
-			std::list<Server>::const_iterator iter;
-			AbortIfNot(lookup(id, iter),
+			ProbeScope<probe_read> probe(size);
+
+			const Server* server;
+			AbortIfNot(lookup(id, server),
 				false);
-			AbortIfNot(iter->manager.read(iter->mem_id, buf,
-				size), false);
 
-			return true;
+			const StatsPage& stats = server->header->stats;
+			const uint64_t seq = stats.sequence();
+
+			AbortIf(server->size < size,
+				false);
+
+			std::memcpy(buf, server->data, size);
+
+			stats.sample(seq, server->last_seq, *server->latency);
+
+			/*
+			 * Clients that couldn't join the peer registry have no
+			 * stats entry, in which case this does nothing
+			 */
+			server->header->stats.read(server->peer_slot, size, seq);
+			return probe.result(true);
 		}
 
 		/**
@@ -741,67 +1843,684 @@ namespace SharedMemory
 		 */
 		bool write( int id, const void* buf, size_t size ) const
 		{
-			std::list<Server>::const_iterator iter;
-			AbortIfNot(lookup(id, iter),
+			ProbeScope<probe_write> probe(size);
+
+			const Server* server;
+			AbortIfNot(lookup(id, server),
 				false);
 
-			AbortIf(iter->access != read_write,
+			AbortIf(server->access != read_write,
 				false);
 
-			/*
-			 * Lock this resource into physical memory while making
-			 * changes
-			 */
-			AbortIf(::mlock( iter->addr, iter->size ) == -1,
+			return probe.result(write_segment(server->header,
+				server->size, buf, size, server->flow, server->peer_slot,
+				server->sync_writes, server->timestamps));
+		}
+
+		/**
+		 * Acquire the lock of a shared object for writing. If a
+		 * process died while holding it, the lock is taken back and
+		 * the object is flagged (see \ref needs_validation())
+		 *
+		 * @param[in] id A unique ID returned by /ref attach()
+		 *
+		 * @return True on success
+		 */
+		bool lock(int id)
+		{
+			Server* server;
+			AbortIfNot(lookup_rw(id, server),
+				false);
+			AbortIfNot(server->header->lock(server->peer_slot),
 				false);
 
-			AbortIfNot(iter->manager.write(iter->mem_id,
-				buf, size), false);
+			return true;
+		}
 
-			AbortIf(::munlock(iter->addr, iter->size) == -1,
+		/**
+		 * Release the lock of a shared object held for writing
+		 *
+		 * @param[in] id A unique ID returned by /ref attach()
+		 *
+		 * @return True on success
+		 */
+		bool unlock(int id)
+		{
+			Server* server;
+			AbortIfNot(lookup_rw(id, server),
 				false);
 
-			/*
-			 * Flush changes back to the file system. Note that this
-			 * commits the entire file
-			 */
-			AbortIf(::msync(iter->addr, iter->size,
-						MS_SYNC | MS_INVALIDATE) == -1,
+			server->header->rwlock.unlock();
+			return true;
+		}
+
+		/**
+		 * Acquire the lock of a shared object for reading. Since
+		 * this modifies the lock, read-write access is required
+		 *
+		 * @param[in] id A unique ID returned by /ref attach()
+		 *
+		 * @return True on success
+		 */
+		bool lock_shared(int id)
+		{
+			Server* server;
+			AbortIfNot(lookup_rw(id, server),
+				false);
+			AbortIfNot(server->header->lock_shared(server->peer_slot),
 				false);
 
 			return true;
 		}
 
-	private:
+		/**
+		 * Release the lock of a shared object held for reading
+		 *
+		 * @param[in] id A unique ID returned by /ref attach()
+		 *
+		 * @return True on success
+		 */
+		bool unlock_shared(int id)
+		{
+			Server* server;
+			AbortIfNot(lookup_rw(id, server),
+				false);
+
+			server->header->rwlock.unlock_shared();
+			return true;
+		}
 
 		/**
-		 *  Look up a shared memory object by ID, returning an
-		 *  iterator to the object
+		 * Acquire the priority-inheritance mutex of a shared object
 		 *
-		 * @param[in] id    An ID returned by /ref attach()
-		 *                  to identify the shared object
-		 * @param[out] iter An iterator pointing the shared
-		 *                  object
+		 * @param[in] id A unique ID returned by /ref attach()
 		 *
-		 * @return True if found
+		 * @return True on success
+		 */
+		bool lock_pi(int id)
+		{
+			Server* server;
+			AbortIfNot(lookup_rw(id, server),
+				false);
+			AbortIfNot(server->header->lock_pi(server->peer_slot),
+				false);
+
+			return true;
+		}
+
+		/**
+		 * Release the priority-inheritance mutex of a shared object
+		 *
+		 * @param[in] id A unique ID returned by /ref attach()
+		 *
+		 * @return True on success
+		 */
+		bool unlock_pi(int id)
+		{
+			Server* server;
+			AbortIfNot(lookup_rw(id, server),
+				false);
+
+			server->header->pi_mutex.unlock();
+			return true;
+		}
+
+		/**
+		 * Check whether a writer died while holding the lock of a
+		 * shared object, in which case its data may be half-written
+		 *
+		 * @param[in] id A unique ID returned by /ref attach()
+		 *
+		 * @return True if the data should be validated
+		 */
+		bool needs_validation(int id) const
+		{
+			const Server* server;
+			AbortIfNot(lookup(id, server),
+				false);
+
+			return server->header->flags.load() &
+				SegmentHeader::needs_validation;
+		}
+
+		/**
+		 * Clear the flag raised by a lock recovery, once the data
+		 * has been checked or repaired
+		 *
+		 * @param[in] id A unique ID returned by /ref attach()
+		 *
+		 * @return True on success
+		 */
+		bool validated(int id)
+		{
+			Server* server;
+			AbortIfNot(lookup_rw(id, server),
+				false);
+
+			server->header->flags.fetch_and(
+				~SegmentHeader::needs_validation);
+			return true;
+		}
+
+		/**
+		 * Get the epoch table of a shared object. Readers use it to
+		 * announce which epoch they're reading at; since that means
+		 * writing to the table, read-write access is required
+		 *
+		 * @param[in] id A unique ID returned by /ref attach()
+		 *
+		 * @return The epoch table, or NULL on error
+		 */
+		EpochTable* epochs(int id)
+		{
+			Server* server;
+			AbortIfNot(lookup_rw(id, server),
+				NULL);
+
+			return &server->header->epochs;
+		}
+
+		/**
+		 * Get the registry of processes attached to a shared object.
+		 * Listing live peers always works; freeing the slots of dead
+		 * ones needs a client that could open the object for writing
+		 * (see \ref map_segment())
+		 *
+		 * @param[in] id A unique ID returned by /ref attach()
+		 *
+		 * @return The registry, or NULL on error
+		 */
+		PeerRegistry* peers(int id)
+		{
+			const Server* server;
+			AbortIfNot(lookup(id, server),
+				NULL);
+
+			return &server->header->peers;
+		}
+
+		/**
+		 * Grant credits to the producers of a shared object, letting
+		 * them write that many more messages. Called by a consumer
+		 * once it's done with what it has read. A read-only client
+		 * may grant credits unless it could only open the object
+		 * read-only (see \ref map_segment())
+		 *
+		 * @param[in] id      A unique ID returned by /ref attach()
+		 * @param[in] credits The number of credits to grant
+		 *
+		 * @return True on success
+		 */
+		bool grant(int id, uint64_t credits)
+		{
+			const Server* server;
+			AbortIfNot(lookup(id, server),
+				false);
+			AbortIfNot(server->control,
+				false);
+
+			server->header->flow.grant(credits);
+			return true;
+		}
+
+		/**
+		 * Make \ref write() to a shared object spend a credit, and
+		 * choose what happens when there are none left
+		 *
+		 * @param[in] id     A unique ID returned by /ref attach()
+		 * @param[in] policy The flow control policy
+		 *
+		 * @return True on success
+		 */
+		bool set_flow_control(int id, flow_t policy)
+		{
+			Server* server;
+			AbortIfNot(lookup_rw(id, server),
+				false);
+
+			server->flow = policy;
+			return true;
+		}
+
+		/**
+		 * Fault in and lock every page of a shared object
+		 *
+		 * @param[in] id A unique ID returned by /ref attach()
+		 *
+		 * @return True on success
+		 */
+		bool prefault(int id)
+		{
+			const Server* server;
+			AbortIfNot(lookup(id, server),
+				false);
+			AbortIfNot(SharedMemory::prefault(server->header,
+				server->map_size(), server->access == read_write), false);
+
+			return true;
+		}
+
+		/**
+		 * Choose whether \ref write() to a shared object locks it
+		 * into memory and msync()s it on every call
+		 *
+		 * @param[in] id   A unique ID returned by /ref attach()
+		 * @param[in] sync True to sync on every write (the default)
+		 *
+		 * @return True on success
+		 */
+		bool set_sync_writes(int id, bool sync)
+		{
+			Server* server;
+			AbortIfNot(lookup(id, server),
+				false);
+
+			server->sync_writes = sync;
+			return true;
+		}
+
+		/**
+		 * Turn the trace ring of a shared object on or off, for
+		 * every process using it
+		 *
+		 * @param[in] id      A unique ID returned by /ref attach()
+		 * @param[in] enabled True to record events
+		 *
+		 * @return True on success
+		 */
+		bool set_tracing(int id, bool enabled)
+		{
+			Server* server;
+			AbortIfNot(lookup_rw(id, server),
+				false);
+
+			server->header->ring.enable(enabled);
+			return true;
+		}
+
+		/**
+		 * Get the address of a shared object's data, for direct
+		 * access. Unlike \ref read() and \ref write(), access
+		 * through it takes no lock and isn't counted in the stats
+		 *
+		 * @param[in] id A unique ID returned by /ref attach()
+		 *
+		 * @return The address, or NULL if \a id is unknown
+		 */
+		void* data(int id) const
+		{
+			const Server* server;
+			AbortIfNot(lookup(id, server),
+				NULL);
+
+			return server->data;
+		}
+
+		/**
+		 * Get the layout hash a shared object was created with
+		 *
+		 * @param[in]  id     A unique ID returned by /ref attach()
+		 * @param[out] layout The hash of its \ref StaticLayout, or 0
+		 *                    if untyped
+		 *
+		 * @return True on success
+		 */
+		bool layout(int id, uint64_t& layout) const
+		{
+			const Server* server;
+			AbortIfNot(lookup(id, server),
+				false);
+
+			layout = server->header->layout;
+			return true;
+		}
+
+		/**
+		 * Get the number of messages written to a shared object.
+		 * Each write bumps this only once its data is in place, so
+		 * a reader that polls it for a change never sees a message
+		 * half copied
+		 *
+		 * @param[in]  id  A unique ID returned by /ref attach()
+		 * @param[out] seq The sequence number of the latest write
+		 *
+		 * @return True on success
+		 */
+		bool sequence(int id, uint64_t& seq) const
+		{
+			const Server* server;
+			AbortIfNot(lookup(id, server),
+				false);
+
+			seq = server->header->stats.sequence();
+			return true;
+		}
+
+		/**
+		 * Choose whether \ref write() to a shared object stamps
+		 * each message with the TSC, so that readers can measure
+		 * publish-to-read latency
+		 *
+		 * @param[in] id      A unique ID returned by /ref attach()
+		 * @param[in] enabled True to stamp writes (default false)
+		 *
+		 * @return True on success
 		 */
-		inline bool lookup(int id,
-				std::list<Server>::const_iterator& iter) const
+		bool set_timestamps(int id, bool enabled)
 		{
-			std::list<Server>::const_iterator end =
-				_servers.end();
+			Server* server;
+			AbortIfNot(lookup_rw(id, server),
+				false);
+
+			server->timestamps = enabled;
+			return true;
+		}
+
+		/**
+		 * Get the publish-to-read latencies seen by this process on
+		 * a shared object. \ref read() records one for the first
+		 * read of each message that its writer stamped (see \ref
+		 * set_timestamps())
+		 *
+		 * @param[in]  id      A unique ID returned by /ref attach()
+		 * @param[out] latency The histogram
+		 *
+		 * @return True on success
+		 */
+		bool latency(int id, LatencyHistogram& latency) const
+		{
+			const Server* server;
+			AbortIfNot(lookup(id, server),
+				false);
+
+			latency = *server->latency;
+			return true;
+		}
+
+		/**
+		 * Forget the latencies recorded for a shared object
+		 *
+		 * @param[in] id A unique ID returned by /ref attach()
+		 *
+		 * @return True on success
+		 */
+		bool reset_latency(int id)
+		{
+			Server* server;
+			AbortIfNot(lookup(id, server),
+				false);
+
+			server->latency->reset();
+			return true;
+		}
+
+		/**
+		 * Get the flow control counters of a shared object
+		 *
+		 * @param[in]  id    A unique ID returned by /ref attach()
+		 * @param[out] stats The counters
+		 *
+		 * @return True on success
+		 */
+		bool flow_stats(int id, FlowStats& stats) const
+		{
+			const Server* server;
+			AbortIfNot(lookup(id, server),
+				false);
+
+			stats = server->header->flow.stats();
+			return true;
+		}
+
+		/**
+		 * Signal to the other processes attached to a shared object
+		 * that we're alive and making progress. Clients that could
+		 * only open the object read-only aren't registered
+		 *
+		 * @param[in] id     A unique ID returned by /ref attach()
+		 * @param[in] cursor Our current position, e.g. the sequence
+		 *                   number of the last message consumed
+		 *
+		 * @return True on success
+		 */
+		bool heartbeat(int id, uint64_t cursor)
+		{
+			const Server* server;
+			AbortIfNot(lookup(id, server),
+				false);
+			AbortIf(server->peer_slot < 0,
+				false);
+
+			server->header->peers.heartbeat(server->peer_slot, cursor);
+			return true;
+		}
 
-			for (iter = _servers.begin(); iter != end; ++iter)
+	private:
+
+		static std::string _real_name(const std::string& name)
+		{
+			return name[0] == '/' ? name : "/" + name;
+		}
+
+		void _swap(MemoryClient& other)
+		{
+			std::swap(_free,    other._free);
+			std::swap(_names,   other._names);
+			std::swap(_servers, other._servers);
+		}
+
+		/*
+		 * Open an object, and map it unless it's attached lazily. A
+		 * lazy attachment only checks that the object is big enough.
+		 * This touches nothing but its arguments, so that \ref
+		 * attach_all() can run it on several threads
+		 */
+		static bool _open(const std::string& real_name, access_t access,
+						  size_t size, bool lazy, int& fd,
+						  SegmentHeader*& header)
+		{
+			AbortIf(access != read_only && access != read_write,
+				false);
+
+			fd = open_segment(real_name, access);
+			AbortIf(fd == -1, false);
+
+			header = NULL;
+
+			bool ok;
+			if (lazy)
 			{
-				if (iter->id == id) return true;
+				struct stat st;
+				ok = ::fstat(fd, &st) == 0 &&
+					static_cast<size_t>(st.st_size) >=
+						data_offset() + size;
 			}
+			else
+				ok = map_segment(fd, access, size, 0, header);
 
-			return false;
+			if (!ok)
+			{
+				::close(fd);
+				AbortIf(true, false, "can't attach to %s\n",
+					real_name.c_str());
+			}
+
+			return true;
+		}
+
+		/*
+		 * Enter an opened object in the handle table
+		 */
+		bool _insert(const std::string& real_name, access_t access,
+					 size_t size, int fd, SegmentHeader* header, int& id)
+		{
+			/*
+			 * Reuse a free entry of the handle table if there is
+			 * one
+			 */
+			size_t index;
+			if (_free.empty())
+			{
+				AbortIf(_servers.size() > index_mask, false);
+
+				index = _servers.size();
+				_servers.emplace_back();
+			}
+			else
+			{
+				index = _free.back();
+				_free.pop_back();
+			}
+
+			Server& server = _servers[index];
+
+			server.size        = size;
+			server.last_seq    = 0;
+			server.access      = access;
+			server.flow        = flow_off;
+			server.peer_slot   = -1;
+			server.control     = false;
+			server.lazy        = header == NULL;
+			server.sync_writes = true;
+			server.timestamps  = false;
+
+			server.mapping.reset(new Mapping(fd, real_name));
+			server.latency = &server.mapping->latency;
+
+			if (header)
+				_mapped(server, header);
+
+			id = _id(index, server.generation);
+			_names[real_name] = id;
+
+			return true;
+		}
+
+		/*
+		 * Map an object that was attached lazily. Threads that get
+		 * here together wait for the first to map it, and see its
+		 * result; if mapping fails, it isn't tried again
+		 */
+		static bool _map(Server& server)
+		{
+			std::call_once(server.mapping->mapped, [&server]() {
+				SegmentHeader* header;
+				if (map_segment(server.mapping->fd, server.access,
+						server.size, 0, header))
+					_mapped(server, header);
+			});
+
+			AbortIfNot(server.header, false);
+			return true;
 		}
 
+		/*
+		 * Finish attaching once an object is mapped
+		 */
+		static void _mapped(Server& server, SegmentHeader* header)
+		{
+			server.header = header;
+			server.data   =
+				reinterpret_cast<char*>(header) + data_offset();
+
+			/*
+			 * Announce ourselves to the other processes. This means
+			 * writing to the header, which we can't do if the object
+			 * could only be opened read-only
+			 */
+			server.control = opened_for_writing(server.mapping->fd);
+
+			if (server.control)
+			{
+				server.peer_slot =
+					static_cast<int16_t>(header->peers.join());
+				header->stats.reset(server.peer_slot);
+			}
+		}
+
+		/*
+		 * Make the ID of an entry of the handle table
+		 */
+		static int _id(size_t index, uint32_t generation)
+		{
+			return static_cast<int>(generation << index_bits | index);
+		}
+
+		/*
+		 * Find the table entry for an ID, whether or not the object
+		 * has been mapped yet
+		 */
+		inline Server* _find(int id) const
+		{
+			const size_t index = static_cast<uint32_t>(id) & index_mask;
+
+			if (id < 0 || index >= _servers.size())
+				return NULL;
+
+			/*
+			 * Mapping a lazy attachment on first use changes the
+			 * entry but not what the ID refers to, so it's allowed
+			 * through a const client. \ref _map() makes sure this
+			 * happens once
+			 */
+			Server* server = const_cast<Server*>(&_servers[index]);
+
+			if (server->mapping && server->generation ==
+					static_cast<uint32_t>(id) >> index_bits)
+				return server;
+
+			return NULL;
+		}
+
+		/**
+		 *  Look up a shared memory object by ID. This is an index
+		 *  into the handle table and a check of the generation. An
+		 *  object attached lazily is mapped here
+		 *
+		 * @param[in]  id     An ID returned by /ref attach()
+		 *                    to identify the shared object
+		 * @param[out] server The shared object
+		 *
+		 * @return True if found
+		 */
+		inline bool lookup(int id, const Server*& server) const
+		{
+			Server* found = _find(id);
+			if (!found)
+				return false;
+
+			server = found;
+
+			return !found->lazy || _map(*found);
+		}
+
+		/*
+		 * Look up a shared object whose settings we want to change
+		 */
+		inline bool lookup(int id, Server*& server)
+		{
+			const Server* found;
+			if (!static_cast<const MemoryClient*>(this)->lookup(id,
+					found))
+				return false;
+
+			server = const_cast<Server*>(found);
+			return true;
+		}
+
+		/*
+		 * Look up a shared object we're allowed to modify
+		 */
+		inline bool lookup_rw(int id, Server*& server)
+		{
+			return lookup(id, server) && server->access == read_write;
+		}
 
-		int _last_id;
-		std::list<Server>
+		std::vector<uint32_t>
+			_free;
+		std::unordered_map<std::string, int>
+			_names;
+		std::vector<Server>
 			_servers;
 	};
 }
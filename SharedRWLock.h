@@ -0,0 +1,476 @@
+#ifndef __SHARED_RW_LOCK_H__
+#define __SHARED_RW_LOCK_H__
+
+#include <atomic>
+#include <cstdint>
+#include <sys/types.h>
+
+#include "Futex.h"
+
+namespace SharedMemory
+{
+	/**
+	 *  The result of a lock request
+	 */
+	typedef enum
+	{
+		lock_failed    = -1, /*!< The lock was not acquired      */
+		lock_acquired  =  0, /*!< The lock was acquired normally */
+		lock_recovered =  1  /*!< The lock was acquired after its
+								  owner died holding it          */
+
+	} lock_status_t;
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class SharedRWLock
+	 *
+	 * A writer-preferring reader/writer lock which lives inside a
+	 * shared memory object and is shared by every process that maps
+	 * it. Zero-filled memory is an unlocked lock, so a freshly
+	 * truncated shared object needs no further initialization
+	 *
+	 * The writer side is a single 32-bit futex word:
+	 *
+	 *  bit  31    : held by a writer
+	 *  bit  30    : one or more writers are waiting
+	 *  bit  29    : one or more readers are waiting
+	 *  bits 0-28  : the writer's pid if held for writing
+	 *
+	 * Readers are counted only in a slot owned by their process, so
+	 * taking an uncontended read lock costs one atomic on that slot
+	 * plus a load of the word to check for a writer. A writer sets
+	 * its bit, then waits for every slot to drain. A process owns a
+	 * slot only while it holds read locks
+	 *
+	 * Waiters sleep with a timeout and on expiry check whether the
+	 * holder is still alive. The slot of a reader that died is simply
+	 * freed, which gives back exactly the holds it leaked. A write
+	 * lock taken back from a dead writer is reported as \ref
+	 * lock_recovered, since the protected data may be half-written
+	 *
+	 ******************************************************************
+	 */
+	class SharedRWLock
+	{
+		/*
+		 * The owning process's pid in the upper 32 bits, and the
+		 * read locks it holds in the lower 32, so that claiming,
+		 * counting and giving up the slot are each one atomic step.
+		 * Zero is a free slot
+		 */
+		struct alignas(64) ReaderSlot
+		{
+			std::atomic<uint64_t> owner;
+		};
+
+		static const uint32_t writer_bit      = 1u << 31;
+		static const uint32_t writers_waiting = 1u << 30;
+		static const uint32_t readers_waiting = 1u << 29;
+		static const uint32_t value_mask      = readers_waiting - 1;
+
+	public:
+
+		/**
+		 * The maximum number of processes that may hold read locks
+		 * at the same time. Slots left by processes that died holding
+		 * read locks are taken back when the table is full
+		 */
+		static const size_t max_readers = 64;
+
+		/**
+		 * How long a waiter sleeps before checking whether the lock
+		 * holder died, in nanoseconds
+		 */
+		static const long poll_ns = 10000000;
+
+		/**
+		 * Acquire the lock for writing
+		 *
+		 * @param[out] waited If not NULL, the time spent blocked, in
+		 *                    nanoseconds. The clock is only read if
+		 *                    the lock is contended
+		 *
+		 * @return \ref lock_acquired, or \ref lock_recovered if the
+		 *         previous writer died while holding the lock
+		 */
+		lock_status_t lock(uint64_t* waited = NULL)
+		{
+			const uint32_t self = writer_bit | Futex::self();
+
+			lock_status_t status = lock_acquired;
+			uint64_t start = 0;
+
+			uint32_t expected = 0;
+			if (!_state.compare_exchange_strong(expected, self))
+			{
+				start  = Futex::now_ns();
+				status = _lock_slow(self);
+			}
+
+			if (_busy())
+			{
+				if (start == 0)
+					start = Futex::now_ns();
+				_drain();
+			}
+
+			if (waited)
+				*waited = start ? Futex::now_ns() - start : 0;
+
+			return status;
+		}
+
+		/**
+		 * Release a lock held for writing
+		 */
+		void unlock()
+		{
+			uint32_t cur = writer_bit | Futex::self();
+			if (_state.compare_exchange_strong(cur, 0,
+					std::memory_order_release,
+					std::memory_order_relaxed))
+				return;
+
+			/*
+			 * Someone is waiting. Keep readers out if a writer is
+			 * queued; it will clear the bit once it gets in
+			 */
+			while (!_state.compare_exchange_weak(cur,
+						cur & writers_waiting,
+						std::memory_order_release,
+						std::memory_order_relaxed));
+
+			Futex::wake(&_state, INT32_MAX);
+		}
+
+		/**
+		 * Acquire the lock for reading
+		 *
+		 * @param[out] waited As for \ref lock()
+		 *
+		 * @return \ref lock_acquired, \ref lock_recovered if a dead
+		 *         writer had to be evicted, or \ref lock_failed if
+		 *         all reader slots are taken
+		 */
+		lock_status_t lock_shared(uint64_t* waited = NULL)
+		{
+			const pid_t self = Futex::self();
+
+			if (waited)
+				*waited = 0;
+
+			if (!_hold(self))
+				return lock_failed;
+
+			/*
+			 * Our hold is visible before we look for a writer, and a
+			 * writer's bit before it looks at the slots, so at least
+			 * one of us backs off
+			 */
+			if ((_state.load() & (writer_bit | writers_waiting)) == 0)
+				return lock_acquired;
+
+			const uint64_t start = Futex::now_ns();
+			const lock_status_t status = _lock_shared_slow(self);
+
+			if (waited)
+				*waited = Futex::now_ns() - start;
+
+			return status;
+		}
+
+		/**
+		 * Release a lock held for reading
+		 */
+		void unlock_shared()
+		{
+			_unhold(Futex::self());
+
+			if (_state.load() & writer_bit)
+			{
+				_drained.fetch_add(1);
+				Futex::wake(&_drained, INT32_MAX);
+			}
+		}
+
+		/**
+		 * Get the process holding the lock for writing, e.g. for a
+		 * monitoring tool. The answer may be stale by the time it's
+		 * used
+		 *
+		 * @return The writer's pid, or 0 if not held for writing
+		 */
+		pid_t writer() const
+		{
+			const uint32_t cur = _state.load(std::memory_order_relaxed);
+			return (cur & writer_bit) ?
+				static_cast<pid_t>(cur & value_mask) : 0;
+		}
+
+		/**
+		 * Get the number of read locks held
+		 *
+		 * @return The count, which may be stale by the time it's used
+		 */
+		uint32_t readers() const
+		{
+			uint32_t count = 0;
+			for (size_t i = 0; i < max_readers; i++)
+			{
+				count += static_cast<uint32_t>(
+					_readers[i].owner.load(std::memory_order_relaxed));
+			}
+
+			return count;
+		}
+
+		/**
+		 * Check whether anyone is waiting for the lock
+		 *
+		 * @return True if readers or writers are blocked on it
+		 */
+		bool contended() const
+		{
+			return (_state.load(std::memory_order_relaxed)
+				& (writers_waiting | readers_waiting)) != 0;
+		}
+
+	private:
+
+		/*
+		 * Contended write lock: advertise that a writer is waiting
+		 * so new readers back off, then sleep until the lock frees
+		 * up or its holder turns out to be dead
+		 */
+		lock_status_t _lock_slow(uint32_t self)
+		{
+			lock_status_t status = lock_acquired;
+
+			uint32_t cur = _state.load(std::memory_order_relaxed);
+			while (true)
+			{
+				if ((cur & writer_bit) == 0)
+				{
+					if (_state.compare_exchange_weak(cur,
+							self | (cur & readers_waiting)))
+						return status;
+					continue;
+				}
+
+				if ((cur & writers_waiting) == 0)
+				{
+					if (!_state.compare_exchange_weak(cur,
+							cur | writers_waiting,
+							std::memory_order_relaxed))
+						continue;
+					cur |= writers_waiting;
+				}
+
+				if (Futex::wait(&_state, cur, poll_ns) == ETIMEDOUT
+					&& _recover(cur))
+					status = lock_recovered;
+
+				cur = _state.load(std::memory_order_relaxed);
+			}
+		}
+
+		/*
+		 * Check whether any reader holds the lock
+		 */
+		bool _busy() const
+		{
+			for (size_t i = 0; i < max_readers; i++)
+			{
+				if (_readers[i].owner.load() != 0)
+					return true;
+			}
+
+			return false;
+		}
+
+		/*
+		 * With our writer bit set no new reader gets in. Wait for
+		 * those already in to leave, freeing the slots of any that
+		 * died
+		 */
+		void _drain()
+		{
+			while (true)
+			{
+				const uint32_t seen = _drained.load();
+				if (!_busy())
+					return;
+
+				if (Futex::wait(&_drained, seen, poll_ns) == ETIMEDOUT)
+				{
+					for (size_t j = 0; j < max_readers; j++)
+						_reap(_readers[j]);
+				}
+			}
+		}
+
+		/*
+		 * Contended read lock. Readers yield to waiting writers, so
+		 * give back the hold we counted and wait for the writers to
+		 * finish before counting it again
+		 */
+		lock_status_t _lock_shared_slow(pid_t self)
+		{
+			lock_status_t status = lock_acquired;
+
+			while (true)
+			{
+				unlock_shared();
+
+				uint32_t cur = _state.load(std::memory_order_relaxed);
+				while (cur & (writer_bit | writers_waiting))
+				{
+					if ((cur & readers_waiting) == 0)
+					{
+						if (!_state.compare_exchange_weak(cur,
+								cur | readers_waiting,
+								std::memory_order_relaxed))
+							continue;
+						cur |= readers_waiting;
+					}
+
+					if (Futex::wait(&_state, cur, poll_ns) == ETIMEDOUT)
+					{
+						if (_recover(cur))
+							status = lock_recovered;
+						else if ((cur & writer_bit) == 0)
+						{
+							/*
+							 * Nobody holds the lock, yet writers were
+							 * said to be waiting for a whole poll
+							 * period. They must have died while queued
+							 */
+							_state.compare_exchange_strong(cur,
+								cur & ~writers_waiting,
+								std::memory_order_relaxed);
+						}
+					}
+
+					cur = _state.load(std::memory_order_relaxed);
+				}
+
+				if (!_hold(self))
+					return lock_failed;
+
+				if ((_state.load() & (writer_bit | writers_waiting)) == 0)
+					return status;
+			}
+		}
+
+		/*
+		 * Called after a waiter times out having last seen the lock
+		 * in state 'seen'. If the writer that held it is dead, strip
+		 * its ownership and return true
+		 */
+		bool _recover(uint32_t seen)
+		{
+			if ((seen & writer_bit) == 0)
+				return false;
+
+			const pid_t owner = static_cast<pid_t>(seen & value_mask);
+
+			if (Futex::alive(owner))
+				return false;
+
+			return _state.compare_exchange_strong(seen,
+				seen & (writers_waiting | readers_waiting),
+				std::memory_order_acquire,
+				std::memory_order_relaxed);
+		}
+
+		/*
+		 * Free a slot if the process owning it is dead, which gives
+		 * back the read holds it leaked and nothing else. Returns
+		 * true if the slot was freed
+		 */
+		bool _reap(ReaderSlot& slot)
+		{
+			uint64_t owner = slot.owner.load(std::memory_order_relaxed);
+
+			const pid_t pid = static_cast<pid_t>(owner >> 32);
+			if (pid == 0 || Futex::alive(pid))
+				return false;
+
+			return slot.owner.compare_exchange_strong(owner, 0,
+				std::memory_order_relaxed);
+		}
+
+		/*
+		 * Count a read hold in a slot belonging to a process, or
+		 * claim a free one. Usually the first probe does either.
+		 * A process may end up with holds in more than one slot,
+		 * which only matters for the sum. When every slot is
+		 * taken, those of dead processes are reclaimed first
+		 */
+		bool _hold(pid_t pid)
+		{
+			const uint64_t id = static_cast<uint32_t>(pid);
+
+			while (true)
+			{
+				for (size_t i = 0; i < max_readers; i++)
+				{
+					ReaderSlot& slot = _readers[(id + i) % max_readers];
+
+					uint64_t owner =
+						slot.owner.load(std::memory_order_relaxed);
+					while (owner == 0 || owner >> 32 == id)
+					{
+						const uint64_t next =
+							owner == 0 ? (id << 32 | 1) : owner + 1;
+
+						if (slot.owner.compare_exchange_weak(owner,
+								next))
+							return true;
+					}
+				}
+
+				bool reaped = false;
+				for (size_t i = 0; i < max_readers; i++)
+					reaped = _reap(_readers[i]) || reaped;
+
+				if (!reaped)
+					return false;
+			}
+		}
+
+		/*
+		 * Give back a read hold, freeing the slot with the last one
+		 */
+		void _unhold(pid_t pid)
+		{
+			const uint64_t id = static_cast<uint32_t>(pid);
+
+			for (size_t i = 0; i < max_readers; i++)
+			{
+				ReaderSlot& slot = _readers[(id + i) % max_readers];
+
+				uint64_t owner =
+					slot.owner.load(std::memory_order_relaxed);
+				while (owner >> 32 == id)
+				{
+					const uint64_t next =
+						(owner & 0xffffffffu) == 1 ? 0 : owner - 1;
+
+					if (slot.owner.compare_exchange_weak(owner, next))
+						return;
+				}
+			}
+		}
+
+		std::atomic<uint32_t>
+				   _state;
+		std::atomic<uint32_t>
+				   _drained;
+		ReaderSlot _readers[max_readers];
+	};
+}
+
+#endif
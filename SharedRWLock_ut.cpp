@@ -0,0 +1,177 @@
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "SharedRWLock.h"
+
+/*
+ * Checks the SharedRWLock's recovery from processes that die holding
+ * it, each in its own children. Exits with the number of failures
+ */
+
+using SharedMemory::SharedRWLock;
+
+struct Shared
+{
+	SharedRWLock      lock;
+	std::atomic<int>  writer_in;
+};
+
+Shared* shared = NULL;
+
+void sleep_ms(long ms)
+{
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	::nanosleep(&ts, NULL);
+}
+
+/*
+ * Run 'body' in a child process and return its exit status
+ */
+template <typename F>
+pid_t spawn(F body)
+{
+	std::fflush(stdout);
+
+	const pid_t pid = ::fork();
+	if (pid == 0)
+		::_exit(body());
+
+	return pid;
+}
+
+int reap(pid_t pid)
+{
+	int status;
+	::waitpid(pid, &status, 0);
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+bool check(bool ok, const char* what)
+{
+	std::printf("%s: %s\n", ok ? "passed" : "FAILED", what);
+	return ok;
+}
+
+/*
+ * A reader that dies holding the lock must not keep writers out
+ */
+bool dead_reader()
+{
+	reap(spawn([]() {
+		return shared->lock.lock_shared() == SharedMemory::lock_acquired
+			? 0 : 1; }));
+
+	const bool ok = shared->lock.lock() == SharedMemory::lock_acquired;
+	shared->lock.unlock();
+
+	return check(ok && shared->lock.readers() == 0,
+		"writer gets in after a reader died holding the lock");
+}
+
+/*
+ * Freeing a dead reader's slot gives back its holds and no one
+ * else's: a writer must still wait for the live reader
+ */
+bool dead_and_live_readers()
+{
+	shared->writer_in.store(0);
+
+	SharedMemory::lock_status_t status = shared->lock.lock_shared();
+
+	reap(spawn([]() {
+		return shared->lock.lock_shared() == SharedMemory::lock_acquired
+			? 0 : 1; }));
+
+	const pid_t writer = spawn([]() {
+		if (shared->lock.lock() == SharedMemory::lock_failed)
+			return 1;
+
+		shared->writer_in.store(1);
+		shared->lock.unlock();
+		return 0; });
+
+	/*
+	 * Long enough for the writer to reap the dead reader's slot a
+	 * few times over
+	 */
+	sleep_ms(5 * SharedRWLock::poll_ns / 1000000);
+
+	const bool excluded = shared->writer_in.load() == 0;
+	shared->lock.unlock_shared();
+
+	const bool ok = reap(writer) == 0 && shared->writer_in.load() == 1;
+
+	return check(status == SharedMemory::lock_acquired && excluded && ok,
+		"a dead reader's recovery leaves live holds alone");
+}
+
+/*
+ * A writer that dies holding the lock is evicted, and reported
+ */
+bool dead_writer()
+{
+	reap(spawn([]() {
+		return shared->lock.lock() == SharedMemory::lock_acquired
+			? 0 : 1; }));
+
+	const bool ok =
+		shared->lock.lock_shared() == SharedMemory::lock_recovered;
+	shared->lock.unlock_shared();
+
+	reap(spawn([]() {
+		return shared->lock.lock() == SharedMemory::lock_acquired
+			? 0 : 1; }));
+
+	const bool ok2 = shared->lock.lock() == SharedMemory::lock_recovered;
+	shared->lock.unlock();
+
+	return check(ok && ok2, "a dead writer is evicted");
+}
+
+/*
+ * More dead readers than slots: the slots are reclaimed
+ */
+bool slot_reuse()
+{
+	bool ok = true;
+	for (size_t i = 0; i < SharedRWLock::max_readers + 8 && ok; i++)
+	{
+		ok = reap(spawn([]() {
+			return shared->lock.lock_shared() == SharedMemory::lock_failed
+				? 1 : 0; })) == 0;
+	}
+
+	ok = ok && shared->lock.lock_shared() == SharedMemory::lock_acquired;
+	shared->lock.unlock_shared();
+
+	ok = ok && shared->lock.lock() == SharedMemory::lock_acquired;
+	shared->lock.unlock();
+
+	return check(ok && shared->lock.readers() == 0,
+		"slots of dead readers are reclaimed when all are taken");
+}
+
+int main()
+{
+	void* addr = ::mmap(NULL, sizeof(Shared), PROT_READ | PROT_WRITE,
+						MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		return 1;
+
+	shared = static_cast<Shared*>(addr);
+
+	int failed = 0;
+
+	failed += !dead_reader();
+	failed += !dead_and_live_readers();
+	failed += !dead_writer();
+	failed += !slot_reuse();
+
+	::munmap(addr, sizeof(Shared));
+	return failed;
+}
@@ -0,0 +1,260 @@
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "SharedMemory.h"
+#include "StatsReader.h"
+
+/*
+ * shmtop: watch segments from the outside, like top(1). Each segment
+ * header is mapped read-only through a StatsReader, so the processes
+ * using it are not disturbed. Once a second this prints, per segment:
+ *
+ *  - the header and the segment's layout
+ *  - the lock and epoch state
+ *  - flow control counters
+ *  - per-writer and per-reader rates from the stats page
+ *  - the attached peers, and whether they are still alive
+ *
+ * The block allocator of each process is private to it; the segment
+ * itself holds a single data block, so that's what the layout shows.
+ * With -a, the segments in /dev/shm are rescanned on each refresh
+ *
+ * usage: shmtop [-n count] (-a [prefix] | <segment>...)
+ */
+
+volatile std::sig_atomic_t sigint_raised = 0;
+
+void sig_handler(int)
+{
+	sigint_raised = 1;
+}
+
+/*
+ * Counters from the previous refresh, to compute rates
+ */
+typedef std::map<std::string, SharedMemory::SegmentSnapshot> history_t;
+
+const SharedMemory::EndpointStats* find(
+	const std::vector<SharedMemory::EndpointSnapshot>& endpoints,
+	const SharedMemory::EndpointSnapshot& endpoint)
+{
+	for (size_t i = 0; i < endpoints.size(); i++)
+	{
+		if (endpoints[i].slot == endpoint.slot &&
+			endpoints[i].pid  == endpoint.pid)
+			return &endpoints[i].stats;
+	}
+
+	return NULL;
+}
+
+void print_endpoints(const char* role,
+	const std::vector<SharedMemory::EndpointSnapshot>& endpoints,
+	const std::vector<SharedMemory::EndpointSnapshot>* before,
+	double seconds, uint64_t now)
+{
+	for (size_t i = 0; i < endpoints.size(); i++)
+	{
+		const SharedMemory::EndpointSnapshot& endpoint = endpoints[i];
+		const SharedMemory::EndpointStats& cur = endpoint.stats;
+
+		const SharedMemory::EndpointStats* prev =
+			before ? find(*before, endpoint) : NULL;
+
+		double msgs = 0, bytes = 0, wait = 0, lapped = 0;
+		if (prev && seconds > 0 && cur.messages >= prev->messages)
+		{
+			msgs   = (cur.messages - prev->messages) / seconds;
+			bytes  = (cur.bytes    - prev->bytes)    / seconds;
+			wait   = (cur.wait_ns  - prev->wait_ns)  / seconds / 1e6;
+			lapped = (cur.lapped   - prev->lapped)   / seconds;
+		}
+
+		char age[32] = "-";
+		if (cur.last_ns != 0 && now >= cur.last_ns)
+			std::snprintf(age, sizeof(age), "%.3fs",
+						  (now - cur.last_ns) / 1e9);
+
+		std::printf("  %-6s %3d %7d %10.0f %10.2f %9.2f %8.0f %12llu "
+			"%10s\n", role, endpoint.slot, endpoint.pid, msgs,
+			bytes / 1e6, wait, lapped,
+			static_cast<unsigned long long>(cur.messages), age);
+	}
+}
+
+void print_segment(const SharedMemory::SegmentSnapshot& snapshot,
+				   const SharedMemory::SegmentHeader& header,
+				   const SharedMemory::SegmentSnapshot* before,
+				   double seconds)
+{
+	using namespace SharedMemory;
+
+	const uint64_t now = StatsPage::now_ns();
+
+	std::printf("%s  v%u  %llu bytes%s\n", snapshot.name.c_str(),
+		header.version, static_cast<unsigned long long>(snapshot.size),
+		(snapshot.flags & SegmentHeader::needs_validation) ?
+			"  NEEDS VALIDATION" : "");
+
+	std::printf("  layout   header [0, %zu)  block 0 [%zu, %llu)\n",
+		data_offset(), data_offset(),
+		static_cast<unsigned long long>(data_offset() + snapshot.size));
+
+	const pid_t writer = header.rwlock.writer();
+	std::printf("  locks    rw: %s%s  pi: ",
+		writer ? "write" : header.rwlock.readers() ? "read" : "free",
+		header.rwlock.contended() ? " (contended)" : "");
+
+	if (header.pi_mutex.owner())
+		std::printf("tid %d%s", header.pi_mutex.owner(),
+			header.pi_mutex.contended() ? " (contended)" : "");
+	else
+		std::printf("free");
+
+	std::printf("  epoch %llu\n",
+		static_cast<unsigned long long>(header.epochs.current()));
+
+	if (writer)
+		std::printf("           writer pid %d\n", writer);
+	else if (header.rwlock.readers())
+		std::printf("           %u readers\n", header.rwlock.readers());
+
+	const FlowStats& flow = snapshot.flow;
+	std::printf("  flow     credits %lld  throttled %llu (%.3fs)  "
+		"dropped %llu  rejected %llu\n",
+		static_cast<long long>(flow.granted - flow.consumed),
+		static_cast<unsigned long long>(flow.throttle_events),
+		flow.throttled_ns / 1e9,
+		static_cast<unsigned long long>(flow.dropped),
+		static_cast<unsigned long long>(flow.rejected));
+
+	double rate = 0;
+	if (before && seconds > 0 && snapshot.sequence >= before->sequence)
+		rate = (snapshot.sequence - before->sequence) / seconds;
+
+	std::printf("  traffic  %llu messages, %.0f/s\n",
+		static_cast<unsigned long long>(snapshot.sequence), rate);
+
+	if (!snapshot.writers.empty() || !snapshot.readers.empty())
+	{
+		std::printf("  %-6s %3s %7s %10s %10s %9s %8s %12s %10s\n",
+			"", "slt", "pid", "msg/s", "MB/s", "wait ms/s", "lapped/s",
+			"messages", "last");
+
+		print_endpoints("writer", snapshot.writers,
+			before ? &before->writers : NULL, seconds, now);
+		print_endpoints("reader", snapshot.readers,
+			before ? &before->readers : NULL, seconds, now);
+	}
+
+	std::printf("  peers\n");
+	for (size_t i = 0; i < PeerRegistry::max_peers; i++)
+	{
+		Peer peer;
+		if (!header.peers.peer(i, peer))
+			continue;
+
+		std::printf("  %9d %7d %-5s heartbeat %llu  cursor %llu\n",
+			static_cast<int>(i), peer.pid,
+			Futex::alive(peer.pid) ? "live" : "dead",
+			static_cast<unsigned long long>(peer.heartbeat),
+			static_cast<unsigned long long>(peer.cursor));
+	}
+
+	std::printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+	long count = -1;
+	bool all = false, bad = false;
+	std::string prefix;
+	std::vector<std::string> names;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "-n") == 0 && i+1 < argc)
+			count = std::atol(argv[++i]);
+		else if (std::strcmp(argv[i], "-a") == 0)
+		{
+			all = true;
+			if (i+1 < argc && argv[i+1][0] != '-')
+				prefix = argv[++i];
+		}
+		else if (argv[i][0] == '-')
+			bad = true;
+		else
+			names.push_back(argv[i]);
+	}
+
+	if (bad || (!all && names.empty()))
+	{
+		std::printf("usage: %s [-n count] (-a [prefix] | <segment>...)\n",
+					argv[0]);
+		return 1;
+	}
+
+	SharedMemory::StatsReader reader;
+	for (size_t i = 0; i < names.size(); i++)
+		AbortIfNot(reader.attach(names[i]), 1);
+
+	std::signal(SIGINT, &sig_handler);
+
+	const bool tty = ::isatty(STDOUT_FILENO);
+
+	history_t history;
+	uint64_t last = 0;
+
+	for (long n = 0; !sigint_raised && n != count; n++)
+	{
+		if (n > 0) ::sleep(1);
+
+		/*
+		 * Pick up segments created since the last refresh, and
+		 * drop those that have gone
+		 */
+		if (all)
+		{
+			reader.detach_stale();
+			reader.attach_all(prefix);
+		}
+
+		std::vector<SharedMemory::SegmentSnapshot> snapshots;
+		reader.scrape(snapshots);
+
+		const uint64_t now = SharedMemory::StatsPage::now_ns();
+		const double seconds = last ? (now - last) / 1e9 : 0;
+		last = now;
+
+		if (tty) std::printf("\033[H\033[2J");
+
+		std::printf("shmtop: %zu segment(s)\n\n", snapshots.size());
+
+		history_t current;
+		for (size_t i = 0; i < snapshots.size(); i++)
+		{
+			const SharedMemory::SegmentSnapshot& snapshot = snapshots[i];
+
+			history_t::const_iterator before =
+				history.find(snapshot.name);
+
+			print_segment(snapshot, *reader.header(snapshot.name),
+				before == history.end() ? NULL : &before->second,
+				seconds);
+
+			current[snapshot.name] = snapshot;
+		}
+
+		history.swap(current);
+		std::fflush(stdout);
+	}
+
+	return 0;
+}
@@ -0,0 +1,91 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "StatsReader.h"
+#include "TscClock.h"
+
+/*
+ * shmtrace: dump the trace ring of a segment, e.g. after the process
+ * using it crashed or stalled. The segment header is mapped read-only
+ * and nothing in it is changed, so this is also safe on a live one
+ *
+ * Events are printed oldest first, with times relative to the newest
+ * event. TSC ticks are converted using a calibration taken by this
+ * process, which assumes the counter is invariant and synchronized
+ * across CPUs, as it is on any recent x86. With -c, the calibration
+ * published in a TscClock is used instead
+ *
+ * usage: shmtrace [-n count] [-c clock] <segment>
+ */
+
+int main(int argc, char** argv)
+{
+	using namespace SharedMemory;
+
+	size_t count = TraceRing::capacity;
+	bool bad = false;
+	std::string name, clock;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "-n") == 0 && i+1 < argc)
+			count = std::strtoul(argv[++i], NULL, 10);
+		else if (std::strcmp(argv[i], "-c") == 0 && i+1 < argc)
+			clock = argv[++i];
+		else if (argv[i][0] != '-' && name.empty())
+			name = argv[i];
+		else
+			bad = true;
+	}
+
+	if (bad || name.empty())
+	{
+		std::printf("usage: %s [-n count] [-c clock] <segment>\n",
+			argv[0]);
+		return 1;
+	}
+
+	StatsReader reader;
+	AbortIfNot(reader.attach(name), 1);
+
+	TscClock tsc_clock;
+	if (!clock.empty())
+		AbortIfNot(tsc_clock.attach(clock), 1);
+
+	const TraceRing& ring = reader.header(name)->ring;
+
+	std::vector<TraceRecord> records;
+	ring.dump(records, count);
+
+	std::printf("%s: tracing %s, %zu events\n", name.c_str(),
+		ring.enabled() ? "on" : "off", records.size());
+
+	if (records.empty())
+		return 0;
+
+	const double ticks_per_us = Tsc::ticks_per_ns() * 1000.0;
+	const uint64_t newest = records.back().tsc;
+
+	std::printf("%10s %14s %7s %-9s %s\n", "seq", "time (us)", "pid",
+		"event", "arg");
+
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		const TraceRecord& record = records[i];
+
+		const double us = record.tsc <= newest ?
+			-((newest - record.tsc) / ticks_per_us) :
+			(record.tsc - newest) / ticks_per_us;
+
+		std::printf("%10llu %14.3f %7d %-9s %llu\n",
+			static_cast<unsigned long long>(record.seq), us, record.pid,
+			TraceRing::name(record.type),
+			static_cast<unsigned long long>(record.arg));
+	}
+
+	return 0;
+}
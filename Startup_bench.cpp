@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Benchmark.h"
+#include "SharedMemory.h"
+
+/*
+ * How long a MemoryClient takes to attach to many segments at
+ * startup, and how much of that the batch and lazy attach save
+ *
+ *  serial      attach() to each segment in turn
+ *  batch       attach_all(), opening and mapping on one thread per CPU
+ *  lazy        attach_all() in lazy mode, which only opens each
+ *              segment
+ *  lazy_touch  lazy, then one read() of every segment, which maps it.
+ *              This is the whole cost when every segment is used
+ *
+ * The segments are created by a child process, as they would be in
+ * practice, with 10 up to 10k of them by powers of 10. Each case
+ * prints one JSON line with the total time, the time per segment,
+ * and the speedup over serial. On a single CPU, batch can only save
+ * the per-call overhead of attach()
+ *
+ * usage: startup_bench [max segments] [threads]
+ */
+
+enum case_t { serial, batch, lazy, lazy_touch };
+
+const char* case_names[] = { "serial", "batch", "lazy", "lazy_touch" };
+
+const size_t segment_size = 4096;
+
+/*
+ * Attach to every segment one way, returning the time taken in
+ * nanoseconds, or 0 on failure
+ */
+uint64_t attach(case_t how, size_t segments, size_t threads,
+				const SharedMemory::Bench::SegmentServer<
+					SharedMemory::RemoteMemory>& server,
+				SharedMemory::Bench::PerfCounters& perf)
+{
+	using namespace SharedMemory;
+
+	MemoryClient client;
+
+	std::vector<MemoryClient::Attachment> todo(segments);
+	for (size_t i = 0; i < segments; i++)
+	{
+		todo[i].name   = server.name(i);
+		todo[i].access = read_write;
+		todo[i].size   = segment_size;
+	}
+
+	char buf[64];
+	bool ok = true;
+
+	perf.start();
+	const uint64_t start = Bench::now_ns();
+
+	switch (how)
+	{
+	case serial:
+		for (size_t i = 0; i < segments && ok; i++)
+		{
+			ok = client.attach(todo[i].name, todo[i].access,
+							   todo[i].size, todo[i].id);
+		}
+		break;
+	case batch:
+		ok = client.attach_all(todo, false, threads);
+		break;
+	case lazy:
+	case lazy_touch:
+		ok = client.attach_all(todo, true, threads);
+
+		for (size_t i = 0; i < segments && ok && how == lazy_touch; i++)
+			ok = client.read(todo[i].id, buf, sizeof(buf));
+		break;
+	}
+
+	const uint64_t elapsed = Bench::now_ns() - start;
+	perf.stop();
+
+	return ok ? elapsed : 0;
+}
+
+bool run(size_t segments, size_t threads)
+{
+	using namespace SharedMemory;
+
+	Bench::SegmentServer<RemoteMemory> server("startup_bench");
+
+	bool ok = server.start(segments, read_write, segment_size);
+
+	Bench::PerfCounters perf;
+	uint64_t serial_ns = 0;
+
+	/*
+	 * The first pass over new segments is much slower than any
+	 * after it, so make one before measuring
+	 */
+	if (ok)
+		ok = attach(serial, segments, threads, server, perf) > 0;
+
+	for (int how = serial; how <= lazy_touch && ok; how++)
+	{
+		const uint64_t ns = attach(static_cast<case_t>(how), segments,
+			threads, server, perf);
+
+		ok = ns > 0;
+		if (!ok) break;
+
+		if (how == serial)
+			serial_ns = ns;
+
+		std::printf("{\"bench\":\"startup\",\"case\":\"%s\"%s%s,"
+			"\"seconds\":%.6f,\"us_per_segment\":%.3f,"
+			"\"speedup\":%.2f%s}\n",
+			case_names[how],
+			Bench::field("segments", segments).c_str(),
+			Bench::field("threads", how == serial ? 1 : threads).c_str(),
+			ns / 1e9, ns / 1e3 / segments,
+			double(serial_ns) / ns,
+			perf.fields(segments).c_str());
+		std::fflush(stdout);
+	}
+
+	const bool stopped = server.stop();
+
+	AbortIfNot(ok, false);
+	AbortIfNot(stopped, false);
+
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	size_t max_segments = 10000;
+	size_t threads      =
+		std::max(1u, std::thread::hardware_concurrency());
+
+	if (argc > 1)
+		max_segments = std::strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		threads      = std::strtoul(argv[2], NULL, 10);
+
+	if (max_segments < 1 || threads < 1)
+	{
+		std::printf("usage: %s [max segments] [threads]\n", argv[0]);
+		return 1;
+	}
+
+	const size_t fit = SharedMemory::Bench::fit_open_files(max_segments);
+	if (fit < max_segments)
+	{
+		max_segments = fit;
+		std::fprintf(stderr, "startup_bench: open file limit caps "
+			"segments at %zu\n", max_segments);
+	}
+
+	for (size_t segments = 10; segments <= max_segments; segments *= 10)
+		AbortIfNot(run(segments, threads), 1);
+
+	return 0;
+}
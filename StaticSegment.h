@@ -0,0 +1,434 @@
+#ifndef __STATIC_SEGMENT_H__
+#define __STATIC_SEGMENT_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "abort.h"
+#include "SharedMemory.h"
+
+namespace SharedMemory
+{
+	/*
+	 * One step of FNV-1a, folding in a whole word
+	 */
+	constexpr uint64_t _layout_mix(uint64_t hash, uint64_t value)
+	{
+		return (hash ^ value) * 1099511628211ull;
+	}
+
+	/*
+	 * A field's offset, size, alignment and rough kind, so that e.g.
+	 * an int32_t and a float at the same place still hash apart
+	 */
+	template <typename T>
+	constexpr uint64_t _field_kind()
+	{
+		typedef typename std::remove_all_extents<T>::type U;
+
+		return (std::is_integral<U>::value       ? 1u : 0u)
+			 | (std::is_signed<U>::value         ? 2u : 0u)
+			 | (std::is_floating_point<U>::value ? 4u : 0u)
+			 | (std::is_array<T>::value          ? 8u : 0u);
+	}
+
+	/*
+	 * The fields from some offset on: each is placed at the next
+	 * multiple of its alignment
+	 */
+	template <size_t Offset, typename... Fields>
+	struct _LayoutNode
+	{
+		static constexpr size_t end()   { return Offset; }
+		static constexpr size_t align() { return 1; }
+
+		static constexpr uint64_t hash(uint64_t seed)
+		{
+			return seed;
+		}
+	};
+
+	template <size_t Offset, typename T, typename... Rest>
+	struct _LayoutNode<Offset, T, Rest...>
+	{
+		typedef T type;
+
+		static constexpr size_t offset()
+		{
+			return (Offset + alignof(T) - 1) / alignof(T) * alignof(T);
+		}
+
+		typedef _LayoutNode<offset() + sizeof(T), Rest...> next;
+
+		static constexpr size_t end()
+		{
+			return next::end();
+		}
+
+		static constexpr size_t align()
+		{
+			return alignof(T) > next::align() ? alignof(T) :
+				next::align();
+		}
+
+		static constexpr uint64_t hash(uint64_t seed)
+		{
+			return next::hash(_layout_mix(_layout_mix(_layout_mix(
+				_layout_mix(seed, offset()), sizeof(T)), alignof(T)),
+				_field_kind<T>()));
+		}
+	};
+
+	template <size_t I, typename Node>
+	struct _LayoutField : _LayoutField<I-1, typename Node::next>
+	{
+	};
+
+	template <typename Node>
+	struct _LayoutField<0, Node>
+	{
+		typedef typename Node::type type;
+
+		static constexpr size_t offset()
+		{
+			return Node::offset();
+		}
+	};
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class StaticLayout
+	 *
+	 * The layout of a fixed schema, worked out at compile time. Each
+	 * field is placed at the next multiple of its alignment, as a
+	 * struct's members would be, and the total size is padded to the
+	 * largest alignment:
+	 *
+	 *  typedef StaticLayout<uint64_t, double[16], char[32]> Quote;
+	 *
+	 *  static_assert(Quote::offset<1>() == 8, "");
+	 *  static_assert(Quote::size() == 168, "");
+	 *
+	 * The \ref hash() covers the offset, size, alignment and kind
+	 * (integer, signed, floating point, array) of every field. Fields
+	 * that are themselves structs are known only by their size and
+	 * alignment, so changing a struct's members without changing
+	 * those goes unnoticed
+	 *
+	 ******************************************************************
+	 */
+	template <typename... Fields>
+	struct StaticLayout
+	{
+		typedef _LayoutNode<0, Fields...> _root;
+
+		/**
+		 * The type of a field
+		 */
+		template <size_t I>
+		using type = typename _LayoutField<I, _root>::type;
+
+		/**
+		 * Get the number of fields
+		 *
+		 * @return The count
+		 */
+		static constexpr size_t count()
+		{
+			return sizeof...(Fields);
+		}
+
+		/**
+		 * Get the offset of a field from the start of the data
+		 *
+		 * @return The offset, in bytes
+		 */
+		template <size_t I>
+		static constexpr size_t offset()
+		{
+			return _LayoutField<I, _root>::offset();
+		}
+
+		/**
+		 * Get the alignment the data needs
+		 *
+		 * @return The largest alignment of any field
+		 */
+		static constexpr size_t align()
+		{
+			return _root::align();
+		}
+
+		/**
+		 * Get the total size of the data
+		 *
+		 * @return The size in bytes, padded to \ref align()
+		 */
+		static constexpr size_t size()
+		{
+			return (_root::end() + align() - 1) / align() * align();
+		}
+
+		/**
+		 * Get a hash of the layout, never 0
+		 *
+		 * @return The hash
+		 */
+		static constexpr uint64_t hash()
+		{
+			return _root::hash(_layout_mix(_layout_mix(
+				14695981039346656037ull, count()), size())) | 1;
+		}
+	};
+
+	/*
+	 * Whether every field can live in shared memory: copyable as
+	 * bytes, and holding no pointers, which would mean nothing in
+	 * another process
+	 */
+	template <typename... Fields>
+	struct _shareable : std::true_type
+	{
+	};
+
+	template <typename T, typename... Rest>
+	struct _shareable<T, Rest...> : std::integral_constant<bool,
+		std::is_trivially_copyable<T>::value &&
+		!std::is_pointer<typename std::remove_all_extents<T>::type>::value
+		&& _shareable<Rest...>::value>
+	{
+	};
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class StaticSegment
+	 *
+	 * A shared memory object whose data has a fixed schema known at
+	 * compile time. Fields are accessed in place by index, e.g.
+	 *
+	 *  StaticSegment<uint64_t, double[16]> quotes;
+	 *  quotes.create("quotes");
+	 *  quotes.get<0>() = 42;
+	 *
+	 * and each access compiles down to a load or store at a constant
+	 * offset from the segment's base, with no lookup or size check.
+	 * Unlike RemoteMemory::write() and friends, access takes no lock
+	 * and isn't counted in the segment's stats: use \ref server() or
+	 * \ref client() for those
+	 *
+	 * The creator records the \ref StaticLayout::hash() in the
+	 * segment header, and \ref attach() refuses a segment whose
+	 * layout differs, so that processes built against different
+	 * schemas fail at startup instead of misreading each other
+	 *
+	 ******************************************************************
+	 */
+	template <typename... Fields>
+	class StaticSegment
+	{
+		static_assert(sizeof...(Fields) > 0,
+			"A segment needs at least one field");
+		static_assert(_shareable<Fields...>::value,
+			"Fields must be trivially copyable and not pointers");
+
+	public:
+
+		typedef StaticLayout<Fields...> layout;
+
+		static_assert(layout::align() <= 64,
+			"Fields can't be aligned beyond a cache line");
+
+		/**
+		 * Constructor
+		 */
+		StaticSegment()
+			: _base(NULL), _client(), _id(-1), _server()
+		{
+		}
+
+		/**
+		 * Destructor
+		 */
+		~StaticSegment()
+		{
+			if (_base) destroy();
+		}
+
+		/**
+		 * Move constructor. \a other gives up its segment
+		 */
+		StaticSegment(StaticSegment&& other) : StaticSegment()
+		{
+			_swap(other);
+		}
+
+		/**
+		 * Move assignment. The segment this held, if any, is
+		 * destroyed
+		 */
+		StaticSegment& operator=(StaticSegment&& other)
+		{
+			StaticSegment moved(std::move(other));
+			_swap(moved);
+
+			return *this;
+		}
+
+		StaticSegment(const StaticSegment&) = delete;
+		StaticSegment& operator=(const StaticSegment&) = delete;
+
+		/**
+		 * Create the shared object, zero-filled
+		 *
+		 * @param[in] name   The name to assign to the object
+		 * @param[in] access Permissions to give to other processes
+		 *
+		 * @return True on success
+		 */
+		bool create(const std::string& name,
+					access_t access = read_write)
+		{
+			AbortIf(_base, false);
+
+			AbortIfNot(_server.create(name, access, layout::size(),
+				layout::hash()), false);
+
+			_base = static_cast<char*>(_server.data());
+			return true;
+		}
+
+		/**
+		 * Attach to a shared object created by another process with
+		 * the same layout
+		 *
+		 * @param[in] name   The name of the shared object
+		 * @param[in] access Permissions for this process
+		 *
+		 * @return True on success
+		 */
+		bool attach(const std::string& name, access_t access)
+		{
+			AbortIf(_base, false);
+
+			AbortIfNot(_client.attach(name, access, layout::size(),
+				_id), false);
+
+			uint64_t hash = 0;
+			if (!_client.layout(_id, hash) || hash != layout::hash())
+			{
+				_client.destroy(_id);
+				_id = -1;
+
+				AbortIf(true, false, "%s has a different layout\n",
+					name.c_str());
+			}
+
+			_base = static_cast<char*>(_client.data(_id));
+			return true;
+		}
+
+		/**
+		 * Detach from the shared object. The creator also removes
+		 * it
+		 *
+		 * @return True on success
+		 */
+		bool destroy()
+		{
+			AbortIfNot(_base, false);
+			_base = NULL;
+
+			if (_id == -1)
+				return _server.destroy();
+
+			const int id = _id;
+			_id = -1;
+
+			return _client.destroy(id);
+		}
+
+		/**
+		 * Access a field. Writing to a segment attached read-only
+		 * raises SIGSEGV
+		 *
+		 * @return A reference to the field, in shared memory
+		 */
+		template <size_t I>
+		typename layout::template type<I>& get()
+		{
+			return *reinterpret_cast<typename layout::template type<I>*>(
+				_base + layout::template offset<I>());
+		}
+
+		/**
+		 * Access a field for reading
+		 *
+		 * @return A reference to the field, in shared memory
+		 */
+		template <size_t I>
+		const typename layout::template type<I>& get() const
+		{
+			return *reinterpret_cast<
+				const typename layout::template type<I>*>(
+				_base + layout::template offset<I>());
+		}
+
+		/**
+		 * Get the RemoteMemory behind a created segment, e.g. to
+		 * lock it
+		 *
+		 * @return The RemoteMemory
+		 */
+		RemoteMemory& server()
+		{
+			return _server;
+		}
+
+		/**
+		 * Get the MemoryClient behind an attached segment, e.g. to
+		 * lock it
+		 *
+		 * @return The MemoryClient; the segment is \ref id()
+		 */
+		MemoryClient& client()
+		{
+			return _client;
+		}
+
+		/**
+		 * Get the ID of an attached segment within \ref client()
+		 *
+		 * @return The ID, or -1 if created rather than attached
+		 */
+		int id() const
+		{
+			return _id;
+		}
+
+	private:
+
+		/*
+		 * The mappings stay where they are, so _base can go with
+		 * them
+		 */
+		void _swap(StaticSegment& other)
+		{
+			std::swap(_base,   other._base);
+			std::swap(_client, other._client);
+			std::swap(_id,     other._id);
+			std::swap(_server, other._server);
+		}
+
+		char*        _base;
+		MemoryClient _client;
+		int          _id;
+		RemoteMemory _server;
+	};
+}
+
+#endif
@@ -0,0 +1,340 @@
+#ifndef __STATS_PAGE_H__
+#define __STATS_PAGE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+#include "Futex.h"
+#include "LatencyHistogram.h"
+#include "PeerRegistry.h"
+
+namespace SharedMemory
+{
+	/**
+	 *  A snapshot of the traffic through one side of a segment, i.e.
+	 *  one process writing to it or one process reading from it
+	 */
+	struct EndpointStats
+	{
+		uint64_t messages; /*!< Messages written, or new messages
+								read                               */
+		uint64_t bytes;    /*!< Bytes in those messages            */
+		uint64_t wait_ns;  /*!< Time spent blocked on flow control
+								or the segment lock                */
+		uint64_t lapped;   /*!< Writer: unconsumed messages it
+								overwrote. Reader: times it missed
+								one or more messages               */
+		uint64_t last_ns;  /*!< CLOCK_MONOTONIC time of the last
+								message, or 0                      */
+		uint64_t sequence; /*!< Sequence number of the last message */
+	};
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class StatsPage
+	 *
+	 * Traffic counters kept inside a segment, so that a monitoring
+	 * process can see how the processes using it are doing without
+	 * asking them. Every process registered in the segment's \ref
+	 * PeerRegistry owns one writer and one reader entry, indexed by
+	 * its peer slot, each on its own cache line. Processes only ever
+	 * update their own entries, so the hot path touches no line that
+	 * another writer or reader does, except for the segment-wide
+	 * sequence number bumped by each write
+	 *
+	 * Readers tell new messages from repeated polls of the same one
+	 * by that sequence number, and count only the former. A jump of
+	 * more than one means a message was overwritten before they saw
+	 * it, i.e. the reader was lapped
+	 *
+	 * Writers may also stamp each message with the TSC (see \ref
+	 * Tsc) at the moment it was published, from which readers work
+	 * out how stale the data they see is
+	 *
+	 * Clients that could only open the segment read-only can't
+	 * modify it and so have no entry. Zero-filled memory is a page
+	 * with no traffic
+	 *
+	 ******************************************************************
+	 */
+	class StatsPage
+	{
+		struct alignas(64) Counters
+		{
+			std::atomic<uint64_t> messages;
+			std::atomic<uint64_t> bytes;
+			std::atomic<uint64_t> wait_ns;
+			std::atomic<uint64_t> lapped;
+			std::atomic<uint64_t> last_ns;
+			std::atomic<uint64_t> sequence;
+		};
+
+	public:
+
+		/**
+		 * The number of writer (and reader) entries
+		 */
+		static const size_t max_endpoints = PeerRegistry::max_peers;
+
+		/**
+		 * Read the clock used for \ref EndpointStats::last_ns
+		 *
+		 * @return The CLOCK_MONOTONIC time, in nanoseconds
+		 */
+		static uint64_t now_ns()
+		{
+			return Futex::now_ns();
+		}
+
+		/**
+		 * Zero the entries of a slot, e.g. when a new process takes
+		 * it over
+		 *
+		 * @param[in] slot The caller's peer slot
+		 */
+		void reset(int slot)
+		{
+			if (slot < 0 || static_cast<size_t>(slot) >= max_endpoints)
+				return;
+
+			_clear(_writers[slot]);
+			_clear(_readers[slot]);
+		}
+
+		/**
+		 * Account for a message just written. Call this after the
+		 * data is in place
+		 *
+		 * @param[in] slot    The writer's peer slot
+		 * @param[in] bytes   The message size
+		 * @param[in] wait_ns Time spent blocked before writing
+		 * @param[in] dropped True if it overwrote an unconsumed
+		 *                    message
+		 * @param[in] stamp   The TSC at publication, or 0 for none
+		 *
+		 * @return The message's sequence number
+		 */
+		uint64_t wrote(int slot, size_t bytes, uint64_t wait_ns,
+					   bool dropped, uint64_t stamp = 0)
+		{
+			/*
+			 * Tag the stamp with the sequence number this message
+			 * is about to get, under a seqlock where 0 means an
+			 * update is in progress. Writers that don't hold the
+			 * segment lock may tag one another's stamps, but then
+			 * their data is no better
+			 */
+			const uint64_t next =
+				_sequence.load(std::memory_order_relaxed) + 1;
+
+			_stamp_seq.store(0, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			_stamp.store(stamp, std::memory_order_relaxed);
+			_stamp_seq.store(next, std::memory_order_release);
+
+			const uint64_t seq =
+				_sequence.fetch_add(1, std::memory_order_release) + 1;
+
+			if (slot < 0 || static_cast<size_t>(slot) >= max_endpoints)
+				return seq;
+
+			Counters& self = _writers[slot];
+
+			self.bytes.fetch_add(bytes, std::memory_order_relaxed);
+			if (wait_ns)
+				self.wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+			if (dropped)
+				self.lapped.fetch_add(1, std::memory_order_relaxed);
+
+			self.last_ns.store(now_ns(), std::memory_order_relaxed);
+			self.sequence.store(seq, std::memory_order_relaxed);
+			self.messages.fetch_add(1, std::memory_order_release);
+
+			return seq;
+		}
+
+		/**
+		 * Get the sequence number of the latest message. A reader
+		 * samples this before copying the data out, and passes it
+		 * to \ref read()
+		 *
+		 * @return The number of messages written to the segment
+		 */
+		uint64_t sequence() const
+		{
+			return _sequence.load(std::memory_order_acquire);
+		}
+
+		/**
+		 * Get the publication stamp of a message, if it's still the
+		 * latest
+		 *
+		 * @param[in] seq What \ref sequence() returned before the
+		 *                read
+		 *
+		 * @return The TSC when it was published, or 0 if the writer
+		 *         doesn't stamp messages or the stamp has moved on
+		 *         to another message
+		 */
+		uint64_t stamp(uint64_t seq) const
+		{
+			const uint64_t tag =
+				_stamp_seq.load(std::memory_order_acquire);
+
+			const uint64_t stamp =
+				_stamp.load(std::memory_order_relaxed);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			if (tag != seq ||
+				_stamp_seq.load(std::memory_order_relaxed) != seq)
+				return 0;
+
+			return stamp;
+		}
+
+		/**
+		 * Account for a read. Only the first read of each message
+		 * is counted
+		 *
+		 * @param[in] slot  The reader's peer slot
+		 * @param[in] bytes The number of bytes read
+		 * @param[in] seq   What \ref sequence() returned before the
+		 *                  read
+		 */
+		void read(int slot, size_t bytes, uint64_t seq)
+		{
+			if (slot < 0 || static_cast<size_t>(slot) >= max_endpoints)
+				return;
+
+			Counters& self = _readers[slot];
+
+			const uint64_t last =
+				self.sequence.load(std::memory_order_relaxed);
+			if (seq == last)
+				return;
+
+			self.bytes.fetch_add(bytes, std::memory_order_relaxed);
+			if (last != 0 && seq > last + 1)
+				self.lapped.fetch_add(1, std::memory_order_relaxed);
+
+			self.last_ns.store(now_ns(), std::memory_order_relaxed);
+			self.sequence.store(seq, std::memory_order_relaxed);
+			self.messages.fetch_add(1, std::memory_order_release);
+		}
+
+		/**
+		 * Time the first read of each stamped message, unless it
+		 * was overwritten during the read. The TSC is only read if
+		 * the writer stamps
+		 *
+		 * @param[in]     seq      What \ref sequence() returned before
+		 *                         the read
+		 * @param[in,out] last_seq The sequence number of the reader's
+		 *                         previous read
+		 * @param[out]    latency  Where to record publish-to-read
+		 *                         latency, in TSC ticks
+		 */
+		void sample(uint64_t seq, uint64_t& last_seq,
+					LatencyHistogram& latency) const
+		{
+			if (seq == last_seq)
+				return;
+
+			last_seq = seq;
+
+			const uint64_t stamp = this->stamp(seq);
+			if (stamp == 0)
+				return;
+
+			const uint64_t now = Tsc::now();
+			if (now >= stamp)
+				latency.add(now - stamp);
+		}
+
+		/**
+		 * Account for time spent blocked, e.g. on the segment lock
+		 *
+		 * @param[in] slot    The caller's peer slot
+		 * @param[in] writer  True to charge the writer entry, false
+		 *                    for the reader entry
+		 * @param[in] wait_ns The time, in nanoseconds
+		 */
+		void waited(int slot, bool writer, uint64_t wait_ns)
+		{
+			if (slot < 0 || static_cast<size_t>(slot) >= max_endpoints)
+				return;
+
+			Counters& self = writer ? _writers[slot] : _readers[slot];
+			self.wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+		}
+
+		/**
+		 * Get the writer entry of a slot
+		 *
+		 * @param[in] slot The peer slot
+		 *
+		 * @return A snapshot of the entry
+		 */
+		EndpointStats writer(size_t slot) const
+		{
+			return _get(_writers[slot % max_endpoints]);
+		}
+
+		/**
+		 * Get the reader entry of a slot
+		 *
+		 * @param[in] slot The peer slot
+		 *
+		 * @return A snapshot of the entry
+		 */
+		EndpointStats reader(size_t slot) const
+		{
+			return _get(_readers[slot % max_endpoints]);
+		}
+
+	private:
+
+		static void _clear(Counters& counters)
+		{
+			counters.bytes.store(0, std::memory_order_relaxed);
+			counters.wait_ns.store(0, std::memory_order_relaxed);
+			counters.lapped.store(0, std::memory_order_relaxed);
+			counters.last_ns.store(0, std::memory_order_relaxed);
+			counters.sequence.store(0, std::memory_order_relaxed);
+			counters.messages.store(0, std::memory_order_release);
+		}
+
+		static EndpointStats _get(const Counters& counters)
+		{
+			EndpointStats stats;
+			stats.messages =
+				counters.messages.load(std::memory_order_acquire);
+			stats.bytes    = counters.bytes.load(std::memory_order_relaxed);
+			stats.wait_ns  =
+				counters.wait_ns.load(std::memory_order_relaxed);
+			stats.lapped   = counters.lapped.load(std::memory_order_relaxed);
+			stats.last_ns  =
+				counters.last_ns.load(std::memory_order_relaxed);
+			stats.sequence =
+				counters.sequence.load(std::memory_order_relaxed);
+
+			return stats;
+		}
+
+		alignas(64) std::atomic<uint64_t>
+				 _sequence;
+		std::atomic<uint64_t>
+				 _stamp_seq;
+		std::atomic<uint64_t>
+				 _stamp;
+		Counters _writers[max_endpoints];
+		Counters _readers[max_endpoints];
+	};
+}
+
+#endif
@@ -0,0 +1,342 @@
+#ifndef __STATS_READER_H__
+#define __STATS_READER_H__
+
+#include <cstdint>
+#include <dirent.h>
+#include <fcntl.h>
+#include <list>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "abort.h"
+#include "SegmentHeader.h"
+
+namespace SharedMemory
+{
+	/**
+	 *  The counters of one process using a segment
+	 */
+	struct EndpointSnapshot
+	{
+		int           slot;  /*!< Peer slot                         */
+		pid_t         pid;   /*!< Process ID, or 0 if it has left   */
+		EndpointStats stats; /*!< Its counters                      */
+	};
+
+	/**
+	 *  Everything a \ref StatsReader knows about a segment
+	 */
+	struct SegmentSnapshot
+	{
+		std::string   name;     /*!< The shared object name         */
+		uint64_t      size;     /*!< Bytes of user data             */
+		uint32_t      flags;    /*!< SegmentHeader::flags           */
+		uint64_t      sequence; /*!< Messages written, in total     */
+		FlowStats     flow;     /*!< Flow control counters          */
+		std::vector<EndpointSnapshot>
+					  writers;  /*!< Processes that wrote to it     */
+		std::vector<EndpointSnapshot>
+					  readers;  /*!< Processes that read from it    */
+	};
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class StatsReader
+	 *
+	 * Scrapes the \ref StatsPage of segments from a separate
+	 * monitoring process. Only the header of each segment is mapped,
+	 * read-only, and nothing is written to it: the reader doesn't
+	 * join the peer registry or take any lock, so the processes
+	 * being watched can't tell it's there
+	 *
+	 ******************************************************************
+	 */
+	class StatsReader
+	{
+		struct Mapping
+		{
+			std::string          name;
+			const SegmentHeader* header;
+			ino_t                inode;
+		};
+
+	public:
+
+		/**
+		 * Constructor
+		 */
+		StatsReader() : _mappings()
+		{
+		}
+
+		/**
+		 * Destructor
+		 */
+		~StatsReader()
+		{
+			while (!_mappings.empty())
+				detach(_mappings.front().name);
+		}
+
+		StatsReader(const StatsReader&) = delete;
+		StatsReader& operator=(const StatsReader&) = delete;
+
+		/**
+		 * Start watching a segment
+		 *
+		 * @param[in] name The name of the shared object
+		 *
+		 * @return True on success
+		 */
+		bool attach(const std::string& name)
+		{
+			Mapping mapping;
+			AbortIfNot(_map(name, mapping), false,
+				"%s is not a segment\n", name.c_str());
+
+			_mappings.push_back(mapping);
+			return true;
+		}
+
+		/**
+		 * Watch every segment in /dev/shm not already attached
+		 *
+		 * @param[in] prefix Only consider names starting with this
+		 *
+		 * @return The number of segments newly attached
+		 */
+		size_t attach_all(const std::string& prefix = "")
+		{
+			DIR* dir = ::opendir("/dev/shm");
+			if (dir == NULL)
+				return 0;
+
+			size_t attached = 0;
+			for (struct dirent* entry = ::readdir(dir); entry != NULL;
+				 entry = ::readdir(dir))
+			{
+				const std::string name =
+					std::string("/") + entry->d_name;
+
+				if (entry->d_name[0] == '.'
+					|| name.compare(1, prefix.size(), prefix) != 0
+					|| _find(name) != _mappings.end())
+					continue;
+
+				Mapping mapping;
+				if (_map(name, mapping))
+				{
+					_mappings.push_back(mapping);
+					attached++;
+				}
+			}
+
+			::closedir(dir);
+			return attached;
+		}
+
+		/**
+		 * Stop watching segments that have been removed from
+		 * /dev/shm, or replaced by another object of the same name
+		 * (which \ref attach_all() will then pick up)
+		 *
+		 * @return The number of segments detached
+		 */
+		size_t detach_stale()
+		{
+			size_t detached = 0;
+
+			std::list<Mapping>::iterator iter = _mappings.begin();
+			while (iter != _mappings.end())
+			{
+				const std::string path = "/dev/shm" + iter->name;
+
+				struct stat st;
+				if (::stat(path.c_str(), &st) == 0 &&
+						st.st_ino == iter->inode)
+				{
+					++iter;
+					continue;
+				}
+
+				::munmap(const_cast<SegmentHeader*>(iter->header),
+						 data_offset());
+
+				iter = _mappings.erase(iter);
+				detached++;
+			}
+
+			return detached;
+		}
+
+		/**
+		 * Stop watching a segment
+		 *
+		 * @param[in] name The name passed to \ref attach()
+		 *
+		 * @return True on success
+		 */
+		bool detach(const std::string& name)
+		{
+			std::list<Mapping>::iterator iter = _find(_real_name(name));
+			AbortIf(iter == _mappings.end(), false);
+
+			::munmap(const_cast<SegmentHeader*>(iter->header),
+					 data_offset());
+
+			_mappings.erase(iter);
+			return true;
+		}
+
+		/**
+		 * Read the counters of every attached segment. Only the
+		 * entries of processes that have moved data or waited in
+		 * that role are reported
+		 *
+		 * @param[out] snapshots One entry per segment
+		 *
+		 * @return The number of segments
+		 */
+		size_t scrape(std::vector<SegmentSnapshot>& snapshots) const
+		{
+			snapshots.resize(_mappings.size());
+
+			size_t i = 0;
+			for (auto iter = _mappings.begin(), end = _mappings.end();
+				 iter != end; ++iter, ++i)
+			{
+				_scrape(*iter, snapshots[i]);
+			}
+
+			return snapshots.size();
+		}
+
+		/**
+		 * Get the header of an attached segment, e.g. to inspect
+		 * its peers
+		 *
+		 * @param[in] name The name passed to \ref attach()
+		 *
+		 * @return The header, mapped read-only, or NULL
+		 */
+		const SegmentHeader* header(const std::string& name) const
+		{
+			for (auto iter = _mappings.begin(), end = _mappings.end();
+				 iter != end; ++iter)
+			{
+				if (iter->name == _real_name(name))
+					return iter->header;
+			}
+
+			return NULL;
+		}
+
+	private:
+
+		static std::string _real_name(const std::string& name)
+		{
+			if (!name.empty() && name[0] == '/')
+				return name;
+
+			return std::string("/") + name;
+		}
+
+		std::list<Mapping>::iterator _find(const std::string& name)
+		{
+			for (auto iter = _mappings.begin(), end = _mappings.end();
+				 iter != end; ++iter)
+			{
+				if (iter->name == name) return iter;
+			}
+
+			return _mappings.end();
+		}
+
+		/*
+		 * Map the header of a shared object, if it is a segment
+		 * created by a compatible RemoteMemory
+		 */
+		static bool _map(const std::string& name, Mapping& mapping)
+		{
+			mapping.name = _real_name(name);
+
+			const int fd = ::shm_open(mapping.name.c_str(), O_RDONLY, 0);
+			if (fd == -1)
+				return false;
+
+			/*
+			 * Touching a page past the end of the file would raise
+			 * SIGBUS
+			 */
+			struct stat st;
+			if (::fstat(fd, &st) == -1 ||
+				static_cast<size_t>(st.st_size) < data_offset())
+			{
+				::close(fd);
+				return false;
+			}
+
+			mapping.inode = st.st_ino;
+
+			void* addr = ::mmap(NULL, data_offset(), PROT_READ,
+								MAP_SHARED, fd, 0);
+			::close(fd);
+
+			if (addr == MAP_FAILED)
+				return false;
+
+			mapping.header = static_cast<const SegmentHeader*>(addr);
+
+			if (!mapping.header->valid(0))
+			{
+				::munmap(addr, data_offset());
+				return false;
+			}
+
+			return true;
+		}
+
+		static void _scrape(const Mapping& mapping,
+							SegmentSnapshot& snapshot)
+		{
+			const SegmentHeader* header = mapping.header;
+			const StatsPage& stats = header->stats;
+
+			snapshot.name     = mapping.name;
+			snapshot.size     = header->size;
+			snapshot.flags    =
+				header->flags.load(std::memory_order_relaxed);
+			snapshot.sequence = stats.sequence();
+			snapshot.flow     = header->flow.stats();
+
+			snapshot.writers.clear();
+			snapshot.readers.clear();
+
+			for (size_t i = 0; i < StatsPage::max_endpoints; i++)
+			{
+				Peer peer;
+				EndpointSnapshot endpoint;
+				endpoint.slot = static_cast<int>(i);
+				endpoint.pid  =
+					header->peers.peer(i, peer) ? peer.pid : 0;
+
+				endpoint.stats = stats.writer(i);
+				if (endpoint.stats.messages || endpoint.stats.wait_ns)
+					snapshot.writers.push_back(endpoint);
+
+				endpoint.stats = stats.reader(i);
+				if (endpoint.stats.messages || endpoint.stats.wait_ns)
+					snapshot.readers.push_back(endpoint);
+			}
+		}
+
+		std::list<Mapping>
+			_mappings;
+	};
+}
+
+#endif
@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sched.h>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Benchmark.h"
+#include "SharedMemory.h"
+
+/*
+ * Streaming throughput of a RemoteMemory channel compared with the
+ * IPC mechanisms people reach for instead. Each case runs one or more
+ * independent producer/consumer process pairs, each pair pushing the
+ * same number of bytes through its own channel, and reports the
+ * aggregate rate as one JSON line
+ *
+ * Transports:
+ *
+ *  shm     A RemoteMemory segment written by the producer and read by
+ *          a MemoryClient. The consumer grants a credit after each
+ *          message and the producer blocks for it (flow_block), so
+ *          nothing is lost. Writes skip the per-write msync
+ *  pipe    A pipe
+ *  unix    A SOCK_STREAM Unix domain socket pair
+ *  memfd   A memfd mapped by both sides, with one eventfd to signal
+ *          that a message is ready and another to acknowledge it
+ *
+ * usage: throughput_bench [max pairs] [min payload] [max payload]
+ */
+
+enum transport_t { shm, pipe_fd, unix_socket, memfd };
+
+const char* transport_names[] = { "shm", "pipe", "unix", "memfd" };
+
+/*
+ * The number of bytes each pair moves, within message count limits
+ */
+const uint64_t bytes_per_pair = 64ull << 20;
+const uint64_t min_messages   = 16;
+const uint64_t max_messages   = 200000;
+
+const bool single_cpu = ::sysconf(_SC_NPROCESSORS_ONLN) < 2;
+
+/*
+ * One producer/consumer channel, set up before forking so both sides
+ * inherit it
+ */
+struct Channel
+{
+	Channel()
+		: mem(NULL), map(NULL), ready(-1), ack(-1)
+	{
+		fds[0] = fds[1] = -1;
+	}
+
+	std::string                 name;
+	SharedMemory::RemoteMemory* mem;
+	int                         fds[2];
+	void*                       map;
+	int                         ready;
+	int                         ack;
+};
+
+bool write_all(int fd, const char* buf, size_t size)
+{
+	while (size > 0)
+	{
+		const ssize_t n = ::write(fd, buf, size);
+		if (n < 0 && errno == EINTR) continue;
+		AbortIf(n <= 0, false);
+
+		buf  += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+bool read_all(int fd, char* buf, size_t size)
+{
+	while (size > 0)
+	{
+		const ssize_t n = ::read(fd, buf, size);
+		if (n < 0 && errno == EINTR) continue;
+		AbortIf(n <= 0, false);
+
+		buf  += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+bool produce(transport_t transport, Channel& channel, size_t payload,
+			 uint64_t messages)
+{
+	std::vector<char> msg(payload, 'x');
+
+	if (transport == shm)
+	{
+		channel.mem->set_flow_control(SharedMemory::flow_block);
+		channel.mem->set_sync_writes(false);
+	}
+
+	for (uint64_t seq = 1; seq <= messages; seq++)
+	{
+		switch (transport)
+		{
+		case shm:
+			AbortIfNot(channel.mem->write(msg.data(), payload), false);
+			break;
+		case pipe_fd:
+		case unix_socket:
+			AbortIfNot(write_all(channel.fds[1], msg.data(), payload),
+				false);
+			break;
+		case memfd:
+		{
+			uint64_t token;
+			if (seq > 1)
+				AbortIf(::read(channel.ack, &token, 8) != 8, false);
+
+			std::memcpy(channel.map, msg.data(), payload);
+
+			token = 1;
+			AbortIf(::write(channel.ready, &token, 8) != 8, false);
+			break;
+		}
+		}
+	}
+
+	return true;
+}
+
+bool consume(transport_t transport, Channel& channel, size_t payload,
+			 uint64_t messages, int go_fd, int ready_fd)
+{
+	std::vector<char> msg(payload);
+
+	SharedMemory::MemoryClient client;
+	int id = 0;
+
+	if (transport == shm)
+	{
+		AbortIfNot(client.attach(channel.name, SharedMemory::read_write,
+								 payload, id), false);
+		AbortIfNot(client.grant(id, 1), false);
+	}
+
+	/*
+	 * Wait for everyone to be set up
+	 */
+	char c;
+	AbortIf(::write(ready_fd, "x", 1) != 1, false);
+	AbortIf(::read(go_fd, &c, 1) != 0, false);
+
+	for (uint64_t seq = 1; seq <= messages; seq++)
+	{
+		switch (transport)
+		{
+		case shm:
+		{
+			/*
+			 * The write sequence only moves once a message has been
+			 * copied in whole, unlike anything in the payload
+			 */
+			uint64_t cur = 0;
+			while (client.sequence(id, cur) && cur < seq)
+			{
+				if (single_cpu) ::sched_yield();
+			}
+
+			AbortIfNot(client.read(id, msg.data(), payload), false);
+			AbortIfNot(client.grant(id, 1), false);
+			break;
+		}
+		case pipe_fd:
+		case unix_socket:
+			AbortIfNot(read_all(channel.fds[0], msg.data(), payload),
+				false);
+			break;
+		case memfd:
+		{
+			uint64_t token;
+			AbortIf(::read(channel.ready, &token, 8) != 8, false);
+
+			std::memcpy(msg.data(), channel.map, payload);
+
+			token = 1;
+			AbortIf(::write(channel.ack, &token, 8) != 8, false);
+			break;
+		}
+		}
+	}
+
+	return true;
+}
+
+bool open_channel(transport_t transport, Channel& channel, int index,
+				  size_t payload)
+{
+	switch (transport)
+	{
+	case shm:
+		channel.name = "throughput_bench_" + std::to_string(index);
+		::shm_unlink(("/" + channel.name).c_str());
+
+		channel.mem = new SharedMemory::RemoteMemory();
+		AbortIfNot(channel.mem->create(channel.name,
+			SharedMemory::read_write, payload), false);
+		break;
+	case pipe_fd:
+		AbortIf(::pipe(channel.fds) == -1, false);
+		break;
+	case unix_socket:
+		AbortIf(::socketpair(AF_UNIX, SOCK_STREAM, 0, channel.fds)
+			== -1, false);
+		break;
+	case memfd:
+	{
+		const int fd = ::memfd_create("throughput_bench", 0);
+		AbortIf(fd == -1, false);
+		AbortIf(::ftruncate(fd, payload) == -1, false);
+
+		channel.map = ::mmap(NULL, payload, PROT_READ | PROT_WRITE,
+							 MAP_SHARED, fd, 0);
+		::close(fd);
+		AbortIf(channel.map == MAP_FAILED, false);
+
+		channel.ready = ::eventfd(0, 0);
+		channel.ack   = ::eventfd(0, 0);
+		AbortIf(channel.ready == -1 || channel.ack == -1, false);
+		break;
+	}
+	}
+
+	return true;
+}
+
+void close_channel(Channel& channel, size_t payload)
+{
+	delete channel.mem;
+
+	for (int i = 0; i < 2; i++)
+		if (channel.fds[i] != -1) ::close(channel.fds[i]);
+
+	if (channel.map != NULL) ::munmap(channel.map, payload);
+	if (channel.ready != -1) ::close(channel.ready);
+	if (channel.ack   != -1) ::close(channel.ack);
+}
+
+bool run(transport_t transport, int pairs, size_t payload)
+{
+	using namespace SharedMemory;
+
+	uint64_t messages = bytes_per_pair / payload;
+	messages = std::max(min_messages, std::min(max_messages, messages));
+
+	std::vector<Channel> channels(pairs);
+	for (int i = 0; i < pairs; i++)
+		AbortIfNot(open_channel(transport, channels[i], i, payload),
+			false);
+
+	int go[2], ready[2];
+	AbortIf(::pipe(go) == -1 || ::pipe(ready) == -1, false);
+
+	/*
+	 * Opened before forking, so that the counts include the
+	 * producers and consumers
+	 */
+	Bench::PerfCounters perf(true);
+
+	/*
+	 * Consumers first, so that each producer starts once all of
+	 * them have attached. Producers wait on the same barrier
+	 */
+	std::vector<pid_t> children;
+	for (int side = 0; side < 2; side++)
+	{
+		for (int i = 0; i < pairs; i++)
+		{
+			const pid_t pid = ::fork();
+			AbortIf(pid == -1, false);
+
+			if (pid != 0)
+			{
+				children.push_back(pid);
+				continue;
+			}
+
+			::close(go[1]);
+
+			bool ok;
+			if (side == 0)
+				ok = consume(transport, channels[i], payload, messages,
+							 go[0], ready[1]);
+			else
+			{
+				char c;
+				ok = ::write(ready[1], "x", 1) == 1
+					&& ::read(go[0], &c, 1) == 0
+					&& produce(transport, channels[i], payload,
+							   messages);
+			}
+
+			::_exit(ok ? 0 : 1);
+		}
+	}
+
+	::close(go[0]);
+	::close(ready[1]);
+
+	for (int i = 0; i < 2*pairs; i++)
+	{
+		char c;
+		AbortIf(::read(ready[0], &c, 1) != 1, false);
+	}
+
+	perf.start();
+
+	const uint64_t start = Bench::now_ns();
+	::close(go[1]);
+
+	bool ok = true;
+	for (size_t i = 0; i < children.size(); i++)
+	{
+		int status;
+		::waitpid(children[i], &status, 0);
+		ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+
+	const double seconds = (Bench::now_ns() - start) / 1e9;
+	perf.stop();
+
+	::close(ready[0]);
+	for (int i = 0; i < pairs; i++)
+		close_channel(channels[i], payload);
+
+	AbortIfNot(ok, false);
+
+	const double total = static_cast<double>(messages) * pairs;
+
+	std::printf("{\"bench\":\"throughput\",\"case\":\"%s\"%s%s%s,"
+		"\"seconds\":%.6f,\"msgs_per_sec\":%.0f,\"gb_per_sec\":%.3f%s}\n",
+		transport_names[transport],
+		Bench::field("payload", payload).c_str(),
+		Bench::field("pairs", pairs).c_str(),
+		Bench::field("messages", messages).c_str(),
+		seconds, total / seconds, total * payload / seconds / 1e9,
+		perf.fields(messages * pairs).c_str());
+	std::fflush(stdout);
+
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	int    max_pairs   = 4;
+	size_t min_payload = 8;
+	size_t max_payload = 16 << 20;
+
+	if (argc > 1)
+		max_pairs   = std::atoi(argv[1]);
+	if (argc > 2)
+		min_payload = std::strtoul(argv[2], NULL, 10);
+	if (argc > 3)
+		max_payload = std::strtoul(argv[3], NULL, 10);
+
+	if (max_pairs < 1 || min_payload < 1
+		|| max_payload < min_payload)
+	{
+		std::printf("usage: %s [max pairs] [min payload] "
+			"[max payload]\n", argv[0]);
+		return 1;
+	}
+
+	for (size_t payload = min_payload; payload <= max_payload;
+		 payload *= 8)
+	{
+		for (int pairs = 1; pairs <= max_pairs; pairs *= 2)
+		{
+			for (int t = shm; t <= memfd; t++)
+			{
+				AbortIfNot(run(static_cast<transport_t>(t), pairs,
+							   payload), 1);
+			}
+		}
+	}
+
+	return 0;
+}
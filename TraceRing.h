@@ -0,0 +1,212 @@
+#ifndef __TRACE_RING_H__
+#define __TRACE_RING_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Futex.h"
+#include "Tsc.h"
+
+namespace SharedMemory
+{
+	/**
+	 *  Kinds of events recorded in a \ref TraceRing
+	 */
+	typedef enum
+	{
+		trace_allocate = 1, /*!< arg is the size                      */
+		trace_free     = 2, /*!< arg is the block ID                  */
+		trace_defrag   = 3, /*!< arg is the number of bytes moved     */
+		trace_write    = 4, /*!< A write started; arg is its size     */
+		trace_publish  = 5, /*!< A write finished; arg is its sequence
+								 number                               */
+		trace_wait     = 6  /*!< arg is the time blocked, in ns       */
+
+	} trace_event_t;
+
+	/**
+	 *  One event read back from a \ref TraceRing
+	 */
+	struct TraceRecord
+	{
+		uint64_t      seq;  /*!< Position in the ring, from 1       */
+		uint64_t      tsc;  /*!< Timestamp counter, see \ref Tsc    */
+		uint64_t      arg;  /*!< Depends on the type                */
+		pid_t         pid;  /*!< The process that recorded it       */
+		trace_event_t type; /*!< What happened                      */
+	};
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class TraceRing
+	 *
+	 * A flight recorder kept inside a segment. When enabled, the
+	 * allocator, writers and waiters log fixed-size binary events
+	 * stamped with the TSC, overwriting the oldest once the ring is
+	 * full. Since it lives in the shared object, the last events
+	 * before a crash or stall outlive the processes that wrote them
+	 * and can be dumped afterwards (see shmtrace)
+	 *
+	 * Recording is a check of the enabled flag, an increment of the
+	 * head, a TSC read and four relaxed stores. Each entry carries
+	 * its sequence number, written last, so that a reader can skip
+	 * entries that were torn by a concurrent writer or a crash
+	 *
+	 * Zero-filled memory is an empty, disabled ring
+	 *
+	 ******************************************************************
+	 */
+	class TraceRing
+	{
+		struct Entry
+		{
+			std::atomic<uint64_t> seq;
+			std::atomic<uint64_t> tsc;
+			std::atomic<uint64_t> arg;
+			std::atomic<uint64_t> info; /* type << 32 | pid */
+		};
+
+	public:
+
+		/**
+		 * The number of events kept
+		 */
+		static const size_t capacity = 1024;
+
+		/**
+		 * Waits shorter than this, in nanoseconds, aren't worth a
+		 * slot in the ring
+		 */
+		static const uint64_t wait_threshold_ns = 1000;
+
+		/**
+		 * Turn recording on or off, for every process using the
+		 * segment
+		 *
+		 * @param[in] enabled True to record
+		 */
+		void enable(bool enabled)
+		{
+			_enabled.store(enabled ? 1 : 0, std::memory_order_relaxed);
+		}
+
+		/**
+		 * Check whether events are being recorded
+		 *
+		 * @return True if recording
+		 */
+		bool enabled() const
+		{
+			return _enabled.load(std::memory_order_relaxed) != 0;
+		}
+
+		/**
+		 * Record an event, if enabled
+		 *
+		 * @param[in] type What happened
+		 * @param[in] arg  Details; see \ref trace_event_t
+		 */
+		void record(trace_event_t type, uint64_t arg)
+		{
+			if (_enabled.load(std::memory_order_relaxed) == 0)
+				return;
+
+			const uint64_t seq =
+				_head.fetch_add(1, std::memory_order_relaxed) + 1;
+
+			Entry& entry = _entries[seq % capacity];
+
+			entry.seq.store(0, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			entry.tsc.store(Tsc::now(), std::memory_order_relaxed);
+			entry.arg.store(arg, std::memory_order_relaxed);
+			entry.info.store(uint64_t(type) << 32 |
+				static_cast<uint32_t>(Futex::self()),
+				std::memory_order_relaxed);
+
+			entry.seq.store(seq, std::memory_order_release);
+		}
+
+		/**
+		 * Read back the most recent events
+		 *
+		 * @param[out] records Up to \a max events, oldest first
+		 * @param[in]  max     The number of events wanted
+		 *
+		 * @return The number of events read
+		 */
+		size_t dump(std::vector<TraceRecord>& records,
+					size_t max = capacity) const
+		{
+			records.clear();
+
+			const uint64_t head = _head.load(std::memory_order_acquire);
+			if (max > capacity) max = capacity;
+
+			const uint64_t first = head > max ? head - max + 1 : 1;
+
+			for (uint64_t seq = first; seq <= head; seq++)
+			{
+				const Entry& entry = _entries[seq % capacity];
+
+				TraceRecord record;
+				record.seq = entry.seq.load(std::memory_order_acquire);
+				record.tsc = entry.tsc.load(std::memory_order_relaxed);
+				record.arg = entry.arg.load(std::memory_order_relaxed);
+
+				const uint64_t info =
+					entry.info.load(std::memory_order_relaxed);
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+
+				/*
+				 * Skip entries being rewritten, or never finished
+				 */
+				if (record.seq != seq ||
+					entry.seq.load(std::memory_order_relaxed) != seq)
+					continue;
+
+				record.pid  = static_cast<pid_t>(info & 0xffffffff);
+				record.type = static_cast<trace_event_t>(info >> 32);
+
+				records.push_back(record);
+			}
+
+			return records.size();
+		}
+
+		/**
+		 * Get the printable name of an event type
+		 *
+		 * @param[in] type The type
+		 *
+		 * @return Its name
+		 */
+		static const char* name(trace_event_t type)
+		{
+			switch (type)
+			{
+			case trace_allocate: return "allocate";
+			case trace_free:     return "free";
+			case trace_defrag:   return "defrag";
+			case trace_write:    return "write";
+			case trace_publish:  return "publish";
+			case trace_wait:     return "wait";
+			default:             return "?";
+			}
+		}
+
+	private:
+
+		std::atomic<uint32_t> _enabled;
+		alignas(64) std::atomic<uint64_t>
+							  _head;
+		alignas(64) Entry     _entries[capacity];
+	};
+}
+
+#endif
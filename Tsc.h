@@ -0,0 +1,115 @@
+#ifndef __TSC_H__
+#define __TSC_H__
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace SharedMemory
+{
+	/**
+	 * The CPU timestamp counter, for timestamps cheap enough to take
+	 * on every event. On machines without one the monotonic clock
+	 * stands in, in which case a tick is a nanosecond
+	 */
+	namespace Tsc
+	{
+		/**
+		 * Read the monotonic clock
+		 *
+		 * @return The current time, in nanoseconds
+		 */
+		inline uint64_t clock_ns()
+		{
+			struct timespec ts;
+			::clock_gettime(CLOCK_MONOTONIC, &ts);
+
+			return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull
+				+ ts.tv_nsec;
+		}
+
+		/**
+		 * Read the timestamp counter
+		 *
+		 * @return The current count
+		 */
+		inline uint64_t now()
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			return __rdtsc();
+#else
+			return clock_ns();
+#endif
+		}
+
+		/**
+		 * Measure how fast the counter runs against the monotonic
+		 * clock, by busy-waiting. A longer measurement is more
+		 * precise
+		 *
+		 * @param[in] duration_ns How long to measure for
+		 *
+		 * @return Ticks per nanosecond
+		 */
+		inline double calibrate(uint64_t duration_ns = 10000000)
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			const uint64_t ns0 = clock_ns(), tsc0 = now();
+
+			uint64_t ns1;
+			while ((ns1 = clock_ns()) < ns0 + duration_ns);
+
+			return double(now() - tsc0) / (ns1 - ns0);
+#else
+			(void)duration_ns;
+			return 1.0;
+#endif
+		}
+
+		/*
+		 * The rate used by ticks_per_ns(), or 0 until known
+		 */
+		inline std::atomic<double>& _rate()
+		{
+			static std::atomic<double> rate(0.0);
+			return rate;
+		}
+
+		/**
+		 * Get the rate at which the counter runs. Unless set with
+		 * \ref set_ticks_per_ns(), it's measured on first use,
+		 * which takes about 10 ms, and the result cached
+		 *
+		 * @return Ticks per nanosecond
+		 */
+		inline double ticks_per_ns()
+		{
+			double rate = _rate().load(std::memory_order_relaxed);
+			if (rate == 0.0)
+			{
+				rate = calibrate();
+				_rate().store(rate, std::memory_order_relaxed);
+			}
+
+			return rate;
+		}
+
+		/**
+		 * Use a rate measured elsewhere, e.g. one published through
+		 * a \ref TscClock, instead of measuring it in this process
+		 *
+		 * @param[in] rate Ticks per nanosecond
+		 */
+		inline void set_ticks_per_ns(double rate)
+		{
+			if (rate > 0.0)
+				_rate().store(rate, std::memory_order_relaxed);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,439 @@
+#ifndef __TSC_CLOCK_H__
+#define __TSC_CLOCK_H__
+
+#include <atomic>
+#include <cstdint>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "abort.h"
+#include "Tsc.h"
+
+namespace SharedMemory
+{
+	/**
+	 *  A conversion from TSC ticks to CLOCK_MONOTONIC nanoseconds:
+	 *
+	 *  ns = ns_base + ((tsc - tsc_base) * mult) >> shift
+	 */
+	struct TscParams
+	{
+		uint64_t tsc_base; /*!< The TSC at the reference point       */
+		uint64_t ns_base;  /*!< The monotonic time at that point     */
+		uint64_t mult;     /*!< Nanoseconds per tick, << shift       */
+		uint32_t shift;    /*!< Fixed-point scale of \ref mult       */
+
+		/**
+		 * Convert a TSC reading
+		 *
+		 * @param[in] tsc The reading
+		 *
+		 * @return The equivalent CLOCK_MONOTONIC time, in
+		 *         nanoseconds
+		 */
+		uint64_t to_ns(uint64_t tsc) const
+		{
+			typedef unsigned __int128 uint128_t;
+
+			if (tsc >= tsc_base)
+				return ns_base + static_cast<uint64_t>(
+					(uint128_t(tsc - tsc_base) * mult) >> shift);
+			else
+				return ns_base - static_cast<uint64_t>(
+					(uint128_t(tsc_base - tsc) * mult) >> shift);
+		}
+
+		/**
+		 * Get the rate of the counter
+		 *
+		 * @return Ticks per nanosecond
+		 */
+		double ticks_per_ns() const
+		{
+			return mult == 0 ? 0.0 :
+				double(uint64_t(1) << shift) / mult;
+		}
+	};
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class TscPage
+	 *
+	 * One set of \ref TscParams in shared memory, published by a
+	 * single process and read by any number of others under a
+	 * seqlock. The sequence number is odd while an update is in
+	 * progress, and readers retry if it changed while they read.
+	 * Zero-filled memory is a page with nothing published
+	 *
+	 ******************************************************************
+	 */
+	class TscPage
+	{
+
+	public:
+
+		static const uint32_t magic_id = 0x54534350; /* "TSCP" */
+
+		/**
+		 * Publish new parameters. Only one process may do this
+		 *
+		 * @param[in] params The parameters
+		 */
+		void publish(const TscParams& params)
+		{
+			/*
+			 * A publisher that died mid-update leaves the sequence
+			 * odd, so round up rather than add to it
+			 */
+			const uint32_t seq =
+				_seq.load(std::memory_order_relaxed) | 1;
+
+			_seq.store(seq, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			_tsc_base.store(params.tsc_base, std::memory_order_relaxed);
+			_ns_base.store(params.ns_base, std::memory_order_relaxed);
+			_mult.store(params.mult, std::memory_order_relaxed);
+			_shift.store(params.shift, std::memory_order_relaxed);
+
+			_seq.store(seq + 1, std::memory_order_release);
+			_magic.store(magic_id, std::memory_order_release);
+		}
+
+		/**
+		 * Read the published parameters. This gives up if an update
+		 * never finishes, e.g. because the publisher died during it
+		 *
+		 * @param[out] params The parameters
+		 *
+		 * @return True on success, false if nothing is published
+		 */
+		bool load(TscParams& params) const
+		{
+			for (int i = 0; i < 10000; i++)
+			{
+				const uint32_t seq =
+					_seq.load(std::memory_order_acquire);
+				if (seq & 1)
+					continue;
+
+				params.tsc_base =
+					_tsc_base.load(std::memory_order_relaxed);
+				params.ns_base  =
+					_ns_base.load(std::memory_order_relaxed);
+				params.mult     = _mult.load(std::memory_order_relaxed);
+				params.shift    =
+					_shift.load(std::memory_order_relaxed);
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+
+				if (_seq.load(std::memory_order_relaxed) == seq)
+					return seq != 0;
+			}
+
+			return false;
+		}
+
+		/**
+		 * Check whether anything was ever published
+		 *
+		 * @return True if so
+		 */
+		bool valid() const
+		{
+			return _magic.load(std::memory_order_acquire) == magic_id;
+		}
+
+	private:
+
+		std::atomic<uint32_t> _magic;
+		std::atomic<uint32_t> _seq;
+		std::atomic<uint64_t> _tsc_base;
+		std::atomic<uint64_t> _ns_base;
+		std::atomic<uint64_t> _mult;
+		std::atomic<uint32_t> _shift;
+	};
+
+	/**
+	 ******************************************************************
+	 *
+	 * @class TscClock
+	 *
+	 * A shared object holding a \ref TscPage, so that all processes
+	 * on a machine convert TSC readings to time the same way, and
+	 * none of them has to calibrate or make a system call to do it.
+	 * One process calls \ref create(), which calibrates the counter
+	 * and publishes the result, and then \ref refresh() now and then.
+	 * Each refresh measures against the original reference point, so
+	 * the rate gets more precise the longer the publisher runs
+	 *
+	 * Others \ref attach(), after which \ref to_ns() is a seqlock read
+	 * and a multiply. Both also make Tsc::ticks_per_ns() return the
+	 * published rate in this process, so that e.g. latency histograms
+	 * agree across processes
+	 *
+	 ******************************************************************
+	 */
+	class TscClock
+	{
+
+	public:
+
+		/**
+		 * Constructor
+		 */
+		TscClock()
+			: _name(), _owner(false), _page(NULL), _params()
+		{
+		}
+
+		/**
+		 * Destructor
+		 */
+		~TscClock()
+		{
+			if (_page) detach();
+		}
+
+		TscClock(const TscClock&) = delete;
+		TscClock& operator=(const TscClock&) = delete;
+
+		/**
+		 * Create the shared object and publish a calibration. If it
+		 * already exists, e.g. left by a publisher that crashed, it
+		 * is taken over
+		 *
+		 * @param[in] name           The name of the shared object
+		 * @param[in] calibration_ns How long to calibrate for
+		 *
+		 * @return True on success
+		 */
+		bool create(const std::string& name,
+					uint64_t calibration_ns = 100000000)
+		{
+			AbortIf(_page, false);
+			AbortIf(calibration_ns == 0, false);
+
+			_name = _real_name(name);
+
+			const int fd = ::shm_open(_name.c_str(), O_CREAT | O_RDWR,
+				S_IRWXU | S_IRGRP | S_IROTH);
+			AbortIf(fd == -1, false);
+
+			if (::ftruncate(fd, sizeof(TscPage)) == -1)
+			{
+				::close(fd);
+				AbortIf(true, false);
+			}
+
+			void* addr = ::mmap(NULL, sizeof(TscPage),
+				PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			::close(fd);
+
+			AbortIf(addr == MAP_FAILED, false);
+
+			_page  = static_cast<TscPage*>(addr);
+			_owner = true;
+
+			/*
+			 * Take the reference point, and measure the rate from
+			 * it for the first time
+			 */
+			_sample(_params.tsc_base, _params.ns_base);
+			_params.shift = 32;
+
+			while (Tsc::clock_ns() < _params.ns_base + calibration_ns);
+
+			uint64_t tsc, ns;
+			_sample(tsc, ns);
+
+			_publish(tsc, ns);
+			return true;
+		}
+
+		/**
+		 * Measure the rate again, against the original reference
+		 * point, and publish it. Only the creator may do this
+		 *
+		 * @return True on success
+		 */
+		bool refresh()
+		{
+			AbortIfNot(_page && _owner, false);
+
+			uint64_t tsc, ns;
+			_sample(tsc, ns);
+
+			_publish(tsc, ns);
+			return true;
+		}
+
+		/**
+		 * Attach to a shared object created by another process
+		 *
+		 * @param[in] name The name of the shared object
+		 *
+		 * @return True on success
+		 */
+		bool attach(const std::string& name)
+		{
+			AbortIf(_page, false);
+
+			_name = _real_name(name);
+
+			const int fd = ::shm_open(_name.c_str(), O_RDONLY, 0);
+			AbortIf(fd == -1, false);
+
+			struct stat st;
+			if (::fstat(fd, &st) == -1 ||
+				static_cast<size_t>(st.st_size) < sizeof(TscPage))
+			{
+				::close(fd);
+				AbortIf(true, false, "%s is not a TSC page\n",
+					_name.c_str());
+			}
+
+			void* addr = ::mmap(NULL, sizeof(TscPage), PROT_READ,
+								MAP_SHARED, fd, 0);
+			::close(fd);
+
+			AbortIf(addr == MAP_FAILED, false);
+
+			_page  = static_cast<TscPage*>(addr);
+			_owner = false;
+
+			if (!_page->valid() || !_page->load(_params))
+			{
+				detach();
+				AbortIf(true, false, "%s has no calibration\n",
+					_name.c_str());
+			}
+
+			Tsc::set_ticks_per_ns(_params.ticks_per_ns());
+			return true;
+		}
+
+		/**
+		 * Unmap the shared object. The creator also removes it
+		 *
+		 * @return True on success
+		 */
+		bool detach()
+		{
+			AbortIfNot(_page, false);
+
+			AbortIf(::munmap(_page, sizeof(TscPage)) == -1,
+				false);
+			_page = NULL;
+
+			if (_owner)
+			{
+				_owner = false;
+				AbortIf(::shm_unlink(_name.c_str()) == -1,
+					false);
+			}
+
+			return true;
+		}
+
+		/**
+		 * Get the latest parameters. If they can't be read, the
+		 * last ones that could are returned
+		 *
+		 * @return The parameters
+		 */
+		const TscParams& params() const
+		{
+			if (_page)
+			{
+				TscParams params;
+				if (_page->load(params))
+					_params = params;
+			}
+
+			return _params;
+		}
+
+		/**
+		 * Convert a TSC reading, e.g. a publish stamp
+		 *
+		 * @param[in] tsc The reading
+		 *
+		 * @return The equivalent CLOCK_MONOTONIC time, in
+		 *         nanoseconds
+		 */
+		uint64_t to_ns(uint64_t tsc) const
+		{
+			return params().to_ns(tsc);
+		}
+
+		/**
+		 * Read the time without a system call
+		 *
+		 * @return The CLOCK_MONOTONIC time, in nanoseconds
+		 */
+		uint64_t now_ns() const
+		{
+			return to_ns(Tsc::now());
+		}
+
+	private:
+
+		/*
+		 * Read the TSC and the monotonic clock at the same moment,
+		 * as near as we can: the clock is read between two TSC
+		 * readings, keeping the closest pair of several tries
+		 */
+		static void _sample(uint64_t& tsc, uint64_t& ns)
+		{
+			uint64_t best = UINT64_MAX;
+
+			for (int i = 0; i < 16; i++)
+			{
+				const uint64_t before = Tsc::now();
+				const uint64_t now_ns = Tsc::clock_ns();
+				const uint64_t after  = Tsc::now();
+
+				if (after - before < best)
+				{
+					best = after - before;
+					tsc  = before + best / 2;
+					ns   = now_ns;
+				}
+			}
+		}
+
+		/*
+		 * Publish the rate measured between the reference point and
+		 * (tsc, ns)
+		 */
+		void _publish(uint64_t tsc, uint64_t ns)
+		{
+			const double ns_per_tick =
+				double(ns - _params.ns_base) / (tsc - _params.tsc_base);
+
+			_params.mult = static_cast<uint64_t>(
+				ns_per_tick * (uint64_t(1) << _params.shift) + 0.5);
+
+			_page->publish(_params);
+			Tsc::set_ticks_per_ns(_params.ticks_per_ns());
+		}
+
+		static std::string _real_name(const std::string& name)
+		{
+			return name.empty() || name[0] == '/' ? name : "/" + name;
+		}
+
+		std::string _name;
+		bool        _owner;
+		TscPage*    _page;
+		mutable TscParams
+					_params;
+	};
+}
+
+#endif